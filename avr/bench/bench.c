@@ -0,0 +1,453 @@
+// Cycle counting benchmark for Pumpunjuksautin firmware on simavr
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Runs the firmware in simavr, feeds the requests from a script to
+// the UART and measures the cycles spent in interrupt handlers and
+// chosen functions, interrupt latencies and response times. The
+// results are written as TSV lines of metric name and value.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <gelf.h>
+#include <sim_avr.h>
+#include <sim_elf.h>
+#include <sim_irq.h>
+#include <sim_interrupts.h>
+#include <avr_uart.h>
+
+#define MAX_VECTORS 64
+#define MAX_NESTING 8
+#define MAX_REQUEST 256
+
+// Times in milliseconds
+#define BOOT_TIME 100       // Let the firmware initialize
+#define RESPONSE_IDLE 10    // Silence which ends the response
+#define RESPONSE_TIMEOUT 500
+
+// Each request is repeated to see the effect of caches.
+#define REPEAT 3
+
+// Statistics of a measured quantity
+typedef struct {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+} stat_t;
+
+// Interrupt vector names of ATmega328p
+static char const *const vector_names[] = {
+	[1] = "INT0_vect", [2] = "INT1_vect", [3] = "PCINT0_vect",
+	[4] = "PCINT1_vect", [5] = "PCINT2_vect", [6] = "WDT_vect",
+	[7] = "TIMER2_COMPA_vect", [8] = "TIMER2_COMPB_vect",
+	[9] = "TIMER2_OVF_vect", [10] = "TIMER1_CAPT_vect",
+	[11] = "TIMER1_COMPA_vect", [12] = "TIMER1_COMPB_vect",
+	[13] = "TIMER1_OVF_vect", [14] = "TIMER0_COMPA_vect",
+	[15] = "TIMER0_COMPB_vect", [16] = "TIMER0_OVF_vect",
+	[17] = "SPI_STC_vect", [18] = "USART_RX_vect",
+	[19] = "USART_UDRE_vect", [20] = "USART_TX_vect", [21] = "ADC_vect",
+	[22] = "EE_READY_vect", [23] = "ANALOG_COMP_vect", [24] = "TWI_vect",
+	[25] = "SPM_READY_vect",
+};
+
+// Functions measured. The firmware marks them noinline, because an
+// inlined function is missing from the symbol table.
+static char const *const function_names[] = {
+	"modbus_interface",
+	"ascii_interface",
+	"task_run",
+	"history_tick",
+	"schedule_tick",
+};
+#define FUNCTIONS ((int)(sizeof(function_names) / sizeof(*function_names)))
+#define VECTOR_NAMES ((int)(sizeof(vector_names) / sizeof(*vector_names)))
+
+// Interrupt handler bookkeeping
+typedef struct {
+	uint8_t vector;
+	uint64_t start;
+	uint64_t children; // Cycles spent in nested handlers
+} frame_t;
+
+static avr_t *avr;
+static stat_t isr_cycles[MAX_VECTORS];
+static stat_t isr_latency[MAX_VECTORS];
+static uint64_t pending_since[MAX_VECTORS];
+static frame_t stack[MAX_NESTING];
+static int depth = 0;
+
+// Function bookkeeping
+static uint32_t function_addr[FUNCTIONS];
+static stat_t function_cycles[FUNCTIONS];
+static int active_function = -1;
+static uint64_t function_start;
+static uint16_t function_sp;
+
+// Response bookkeeping
+static uint64_t last_output = 0;   // Cycle of the latest output byte
+static uint64_t first_output = 0;  // Cycle of the first response byte
+static int output_len = 0;
+
+static void load_symbols(char const *path);
+static void on_pending(avr_irq_t *irq, uint32_t value, void *param);
+static void on_running(avr_irq_t *irq, uint32_t value, void *param);
+static void on_output(avr_irq_t *irq, uint32_t value, void *param);
+static void track_functions(void);
+static bool run_until(uint64_t cycle);
+static uint64_t ms(uint32_t n);
+static int parse_request(char *line, char **name, uint8_t *out);
+static uint16_t modbus_crc(uint8_t const *buf, int len);
+static void stat_add(stat_t *s, uint64_t value);
+static void stat_print(FILE *f, char const *name, stat_t const *s);
+static void usage(char const *name);
+
+int main(int argc, char **argv)
+{
+	char const *mcu = "atmega328p";
+	uint32_t freq = 16000000;
+	uint32_t baud = 9600;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "m:f:b:")) != -1) {
+		switch (opt) {
+		case 'm':
+			mcu = optarg;
+			break;
+		case 'f':
+			freq = atol(optarg);
+			break;
+		case 'b':
+			baud = atol(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 3) usage(argv[0]);
+	char const *elf_path = argv[optind];
+	char const *script_path = argv[optind+1];
+	char const *report_path = argv[optind+2];
+
+	elf_firmware_t fw;
+	memset(&fw, 0, sizeof(fw));
+	if (elf_read_firmware(elf_path, &fw)) {
+		errx(1, "Unable to load firmware %s", elf_path);
+	}
+	strncpy(fw.mmcu, mcu, sizeof(fw.mmcu) - 1);
+	fw.frequency = freq;
+
+	avr = avr_make_mcu_by_name(fw.mmcu);
+	if (avr == NULL) errx(1, "Unknown MCU %s", fw.mmcu);
+	avr_init(avr);
+	avr_load_firmware(avr, &fw);
+	load_symbols(elf_path);
+
+	// Hook all interrupt vectors
+	for (int v = 1; v < MAX_VECTORS; v++) {
+		avr_irq_t *irq = avr_get_interrupt_irq(avr, v);
+		if (irq == NULL) continue;
+		avr_irq_register_notify(irq + AVR_INT_IRQ_PENDING, on_pending, (void *)(intptr_t)v);
+		avr_irq_register_notify(irq + AVR_INT_IRQ_RUNNING, on_running, (void *)(intptr_t)v);
+	}
+
+	// Hook UART
+	avr_irq_t *uart_in = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+	avr_irq_t *uart_out = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT);
+	avr_irq_register_notify(uart_out, on_output, NULL);
+
+	// 10 bits per byte on the wire
+	uint64_t const byte_cycles = (uint64_t)freq * 10 / baud;
+
+	FILE *script = fopen(script_path, "r");
+	if (script == NULL) err(1, "Unable to open %s", script_path);
+	FILE *report = fopen(report_path, "w");
+	if (report == NULL) err(1, "Unable to open %s", report_path);
+
+	if (!run_until(avr->cycle + ms(BOOT_TIME))) {
+		errx(1, "Firmware crashed during boot");
+	}
+
+	fprintf(report, "f_cpu\t%u\n", freq);
+
+	char *line = NULL;
+	size_t line_size = 0;
+	bool header = true;
+	while (getline(&line, &line_size, script) != -1) {
+		// Skip the header line
+		if (header) {
+			header = false;
+			continue;
+		}
+
+		char *name;
+		uint8_t req[MAX_REQUEST];
+		int const len = parse_request(line, &name, req);
+		if (len <= 0) continue;
+
+		stat_t first_byte = {0}, complete = {0};
+		for (int round = 0; round < REPEAT; round++) {
+			// Feed the request at the line speed
+			for (int i = 0; i < len; i++) {
+				avr_raise_irq(uart_in, req[i]);
+				if (!run_until(avr->cycle + byte_cycles)) {
+					errx(1, "Firmware crashed in request %s", name);
+				}
+			}
+			uint64_t const sent = avr->cycle;
+
+			// Wait for the response to finish. Every output byte
+			// moves the end of the idle period further.
+			output_len = 0;
+			first_output = 0;
+			last_output = sent;
+			while (true) {
+				uint64_t const end = output_len ?
+					last_output + ms(RESPONSE_IDLE) :
+					sent + ms(RESPONSE_TIMEOUT);
+				if (avr->cycle >= end) break;
+				if (!run_until(end)) {
+					errx(1, "Firmware crashed in request %s", name);
+				}
+			}
+
+			if (output_len == 0) {
+				warnx("No response to %s", name);
+				break;
+			}
+			stat_add(&first_byte, first_output - sent);
+			stat_add(&complete, last_output - sent);
+		}
+
+		char metric[128];
+		snprintf(metric, sizeof(metric), "request.%s.first_byte", name);
+		stat_print(report, metric, &first_byte);
+		snprintf(metric, sizeof(metric), "request.%s.complete", name);
+		stat_print(report, metric, &complete);
+	}
+	free(line);
+	fclose(script);
+
+	// Interrupt handlers, excluding nested handlers
+	stat_t all_latency = {0};
+	for (int v = 0; v < MAX_VECTORS; v++) {
+		if (isr_cycles[v].count == 0) continue;
+		char const *vname = v < VECTOR_NAMES && vector_names[v] ?
+			vector_names[v] : "unknown_vect";
+		char metric[128];
+		snprintf(metric, sizeof(metric), "isr.%s.cycles", vname);
+		stat_print(report, metric, &isr_cycles[v]);
+		snprintf(metric, sizeof(metric), "isr.%s.latency", vname);
+		stat_print(report, metric, &isr_latency[v]);
+		if (isr_latency[v].max > all_latency.max) all_latency.max = isr_latency[v].max;
+		all_latency.count += isr_latency[v].count;
+		all_latency.sum += isr_latency[v].sum;
+	}
+	stat_print(report, "isr.latency", &all_latency);
+
+	// Functions, including the interrupts during them
+	for (int i = 0; i < FUNCTIONS; i++) {
+		if (function_addr[i] == 0) continue;
+		char metric[128];
+		snprintf(metric, sizeof(metric), "function.%s.cycles", function_names[i]);
+		stat_print(report, metric, &function_cycles[i]);
+	}
+
+	if (fclose(report)) err(1, "Unable to write %s", report_path);
+	return 0;
+}
+
+static void usage(char const *name)
+{
+	fprintf(stderr, "Usage: %s [-m MCU] [-f F_CPU] [-b BAUD] FIRMWARE.elf SCRIPT.tsv REPORT.tsv\n", name);
+	exit(1);
+}
+
+// Find the addresses of measured functions from the ELF symbol table.
+static void load_symbols(char const *path)
+{
+	if (elf_version(EV_CURRENT) == EV_NONE) errx(1, "libelf init failed");
+	int const fd = open(path, O_RDONLY);
+	if (fd == -1) err(1, "Unable to open %s", path);
+	Elf *elf = elf_begin(fd, ELF_C_READ, NULL);
+	if (elf == NULL) errx(1, "Unable to parse %s", path);
+
+	Elf_Scn *scn = NULL;
+	while ((scn = elf_nextscn(elf, scn)) != NULL) {
+		GElf_Shdr shdr;
+		gelf_getshdr(scn, &shdr);
+		if (shdr.sh_type != SHT_SYMTAB) continue;
+
+		Elf_Data *data = elf_getdata(scn, NULL);
+		int const count = shdr.sh_size / shdr.sh_entsize;
+		for (int i = 0; i < count; i++) {
+			GElf_Sym sym;
+			gelf_getsym(data, i, &sym);
+			if (GELF_ST_TYPE(sym.st_info) != STT_FUNC) continue;
+			char const *name = elf_strptr(elf, shdr.sh_link, sym.st_name);
+			for (int f = 0; f < FUNCTIONS; f++) {
+				if (strcmp(name, function_names[f]) == 0) {
+					function_addr[f] = sym.st_value;
+				}
+			}
+		}
+	}
+
+	for (int f = 0; f < FUNCTIONS; f++) {
+		if (function_addr[f] == 0) {
+			errx(1, "Function %s not found, probably inlined", function_names[f]);
+		}
+	}
+
+	elf_end(elf);
+	close(fd);
+}
+
+// Interrupt flag raised or cleared.
+static void on_pending(avr_irq_t *irq, uint32_t value, void *param)
+{
+	int const v = (intptr_t)param;
+	if (value) pending_since[v] = avr->cycle;
+}
+
+// Interrupt handler entered or left.
+static void on_running(avr_irq_t *irq, uint32_t value, void *param)
+{
+	int const v = (intptr_t)param;
+	if (value) {
+		stat_add(&isr_latency[v], avr->cycle - pending_since[v]);
+		if (depth == MAX_NESTING) errx(1, "Too deep interrupt nesting");
+		stack[depth++] = (frame_t){ v, avr->cycle, 0 };
+	} else if (depth > 0) {
+		frame_t const f = stack[--depth];
+		uint64_t const total = avr->cycle - f.start;
+		stat_add(&isr_cycles[f.vector], total - f.children);
+		if (depth > 0) stack[depth-1].children += total;
+	}
+}
+
+// Byte transmitted by the firmware.
+static void on_output(avr_irq_t *irq, uint32_t value, void *param)
+{
+	if (output_len++ == 0) first_output = avr->cycle;
+	last_output = avr->cycle;
+}
+
+// Measure function calls. The function has returned when the stack
+// pointer is above the return address pushed by the call.
+static void track_functions(void)
+{
+	uint16_t const sp = avr->data[R_SPL] | avr->data[R_SPH] << 8;
+	if (active_function >= 0) {
+		if (sp > function_sp) {
+			stat_add(&function_cycles[active_function], avr->cycle - function_start);
+			active_function = -1;
+		}
+		return;
+	}
+	for (int f = 0; f < FUNCTIONS; f++) {
+		if (function_addr[f] != 0 && avr->pc == function_addr[f]) {
+			active_function = f;
+			function_start = avr->cycle;
+			function_sp = sp;
+			return;
+		}
+	}
+}
+
+// Run the simulation until the given cycle. Returns false if the
+// firmware has crashed.
+static bool run_until(uint64_t cycle)
+{
+	while (avr->cycle < cycle) {
+		int const state = avr_run(avr);
+		if (state == cpu_Done || state == cpu_Crashed) return false;
+		track_functions();
+	}
+	return true;
+}
+
+static uint64_t ms(uint32_t n)
+{
+	return (uint64_t)avr->frequency * n / 1000;
+}
+
+// Parse a script line: name, protocol and data separated by tabs.
+// Modbus data is hex bytes without CRC, ASCII data is the command
+// line. Returns the frame length or -1 if the line is invalid.
+static int parse_request(char *line, char **name, uint8_t *out)
+{
+	*name = strsep(&line, "\t");
+	char *proto = strsep(&line, "\t");
+	char *data = strsep(&line, "\n");
+	if (proto == NULL || data == NULL) return -1;
+
+	int len = 0;
+	if (strcmp(proto, "ascii") == 0) {
+		len = snprintf((char *)out, MAX_REQUEST, "%s\n", data);
+	} else if (strcmp(proto, "modbus") == 0) {
+		while (*data != '\0' && len < MAX_REQUEST - 2) {
+			if (isspace(*data)) {
+				data++;
+				continue;
+			}
+			unsigned byte;
+			if (sscanf(data, "%2x", &byte) != 1) return -1;
+			out[len++] = byte;
+			data += 2;
+		}
+		uint16_t const crc = modbus_crc(out, len);
+		out[len++] = crc;
+		out[len++] = crc >> 8;
+	} else {
+		return -1;
+	}
+	return len;
+}
+
+static uint16_t modbus_crc(uint8_t const *buf, int len)
+{
+	uint16_t crc = 0xFFFF;
+	for (int i = 0; i < len; i++) {
+		crc ^= buf[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+		}
+	}
+	return crc;
+}
+
+static void stat_add(stat_t *s, uint64_t value)
+{
+	s->count++;
+	s->sum += value;
+	if (value > s->max) s->max = value;
+}
+
+static void stat_print(FILE *f, char const *name, stat_t const *s)
+{
+	fprintf(f, "%s.count\t%" PRIu64 "\n", name, s->count);
+	if (s->count == 0) return;
+	fprintf(f, "%s.mean\t%" PRIu64 "\n", name, s->sum / s->count);
+	fprintf(f, "%s.max\t%" PRIu64 "\n", name, s->max);
+}
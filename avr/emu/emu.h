@@ -0,0 +1,62 @@
+#pragma once
+
+// Host emulator internals. The firmware sources see only the headers
+// in shim/ and the firmware API implemented in serial.c and
+// persist.c.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Simulated analog inputs in millivolts, see hw.c
+typedef struct {
+	uint16_t k5;          // Juksautus line voltage when not pulled down
+	uint16_t error;       // Error LED
+	uint8_t blinks;       // Error LED blink code, 0 if steady
+	uint16_t outside;     // Outside temperature sensor
+	uint16_t accumulator; // Accumulator tank sensor
+	uint16_t int_temp;    // Internal temperature sensor
+} emu_analog_t;
+
+extern emu_analog_t emu_analog;
+
+// Set by signal handlers to save the state and exit at the next
+// sleep.
+extern volatile bool emu_quit;
+
+// Firmware main() renamed by the build.
+int firmware_main(void);
+
+// Save the state and clean up before exiting.
+void emu_shutdown(void);
+
+// Start the emulated hardware at the current host time.
+void hw_init(void);
+
+// Run the peripherals up to the current host time, calling at most
+// max_irqs interrupt handlers. Returns the number of handlers called.
+int hw_run(int max_irqs);
+
+// Nanoseconds from now to the next interrupt, 0 if it's already due.
+int64_t hw_next_irq_ns(void);
+
+// Open a pseudo-terminal and optionally create a symlink to it. A
+// frame ends when there is no input for silence_us microseconds.
+void emu_serial_open(char const *link, uint32_t silence_us);
+
+// Remove the symlink.
+void emu_serial_close(void);
+
+// Wait for serial input at most timeout_ns nanoseconds.
+void emu_serial_wait(int64_t timeout_ns);
+
+// Load the EEPROM contents from a file. If path is NULL or the file
+// doesn't exist, the EEPROM starts erased. Changes are saved to the
+// same file.
+void emu_eeprom_load(char const *path);
+
+// Save the EEPROM if it has changed. Unless forced, saves at most
+// once per second.
+void emu_eeprom_save(bool force);
+
+// Get monotonic host time in nanoseconds.
+int64_t emu_now_ns(void);
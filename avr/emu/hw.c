@@ -0,0 +1,332 @@
+// Pumpunjuksautin emulated ATmega328p peripherals.
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// TIMER2 and ADC are emulated on register level so clock.c, adc.c and
+// juksautin.c run unmodified. Emulated time follows the host
+// monotonic clock. The peripherals are advanced and the interrupt
+// handlers called only when the firmware sleeps, so the handlers
+// never preempt the main loop. If the host falls behind, the
+// emulation catches up a few interrupts at a time. TIMER1 only
+// follows the emulated cycles, so the firmware seems to take no time.
+
+#include <stdlib.h>
+#include <time.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+#include "emu.h"
+#include "../src/pin.h"
+#include "../src/hardware_config.h"
+
+// Interrupts run between serial reads. Keeps the task queue from
+// overflowing when catching up.
+#define IRQS_PER_WAKEUP 4
+
+// ADC conversion takes 13 ADC clock cycles. The first conversion
+// takes longer on the real hardware but that is not emulated.
+#define ADC_CONVERSION 13
+
+// Internal voltage reference in millivolts
+#define ADC_REF 1100
+
+// Time constants of line capacitors in microseconds when charging
+// through the thermistor and when pulled down via FB pin.
+#define LINE_RISE_US 5000
+#define LINE_FALL_US 500
+
+// Error LED blink code timing in milliseconds: each blink is lit for
+// half of the period and the groups are separated by a pause.
+#define BLINK_PERIOD_MS 1000
+#define BLINK_PAUSE_MS 2000
+
+#define NEVER UINT64_MAX
+
+#define IS_OUTPUT(pin) _GET(DDR,pin)
+
+// Registers
+volatile uint8_t DDRB, PORTB, PINB;
+volatile uint8_t DDRC, PORTC, PINC;
+volatile uint8_t DDRD, PORTD, PIND;
+volatile uint8_t TCCR1A, TCCR1B;
+volatile uint16_t TCNT1;
+volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B, TIMSK2, TIFR2;
+volatile uint8_t MCUSR;
+volatile uint8_t ADMUX, ADCSRA, ADCSRB;
+volatile uint16_t ADCW;
+
+// Interrupt handlers in the firmware
+void TIMER2_COMPA_vect(void);
+void TIMER2_COMPB_vect(void);
+void ADC_vect(void);
+
+emu_analog_t emu_analog = {
+	.k5 = 1500,
+	.error = 0,
+	.blinks = 0,
+	.outside = 600,
+	.accumulator = 700,
+	.int_temp = 350,
+};
+
+static int64_t start_ns;         // Host time at cycle 0
+static uint64_t cycle = 0;       // Emulated time in CPU cycles
+static uint64_t timer_next = NEVER; // Cycle of the next TIMER2 tick
+static uint16_t timer_div = 0;   // TIMER2 prescaler, 0 if stopped
+static uint8_t timer_flags = 0;  // TIFR2 as seen by the hardware
+static uint64_t adc_done = NEVER; // Cycle when the conversion ends
+static uint64_t line_updated[JUKSAUTIN_LINES]; // Cycle of the latest line update
+static float line_mv[JUKSAUTIN_LINES];         // Voltage on juksautus lines
+static uint32_t noise = 1;       // Noise generator state
+
+static uint64_t host_cycles(void);
+static bool timer_tick(void);
+static uint8_t timer_count(uint8_t tcnt);
+static uint16_t timer_ticks_until(uint8_t target);
+static void timer_update_prescaler(void);
+static bool adc_complete(void);
+static void adc_check_start(void);
+static uint16_t adc_sample(uint8_t channel);
+static float line_sample(uint8_t line, bool pulled);
+static bool error_lit(void);
+
+void hw_init(void)
+{
+	start_ns = emu_now_ns();
+	for (uint8_t i = 0; i < JUKSAUTIN_LINES; i++) {
+		line_mv[i] = emu_analog.k5;
+	}
+	MCUSR = _BV(PORF);
+}
+
+int hw_run(int const max_irqs)
+{
+	uint64_t const now = host_cycles();
+	int irqs = 0;
+
+	// Interrupt flags are cleared by writing one to them. The
+	// firmware never sees a pending flag because the handlers are
+	// called right away, so the register reads as zero.
+	timer_flags &= ~TIFR2;
+	TIFR2 = 0;
+
+	while (irqs < max_irqs) {
+		timer_update_prescaler();
+		adc_check_start();
+
+		uint64_t const next = adc_done < timer_next ? adc_done : timer_next;
+		if (next > now) {
+			cycle = now;
+			TCNT1 = cycle;
+			break;
+		}
+		cycle = next;
+		TCNT1 = cycle;
+
+		// ADC has lower priority than TIMER2 but they are
+		// rarely due on the same cycle.
+		if (timer_next == cycle && timer_tick()) irqs++;
+		if (adc_done == cycle && adc_complete()) irqs++;
+	}
+	return irqs;
+}
+
+int64_t hw_next_irq_ns(void)
+{
+	uint64_t next = adc_done;
+
+	if (timer_div != 0) {
+		// Next compare match with the interrupt enabled
+		uint16_t ticks = 0x100;
+		if (TIMSK2 & _BV(OCIE2A)) {
+			uint16_t const t = timer_ticks_until(OCR2A);
+			if (t < ticks) ticks = t;
+		}
+		if (TIMSK2 & _BV(OCIE2B)) {
+			uint16_t const t = timer_ticks_until(OCR2B);
+			if (t < ticks) ticks = t;
+		}
+		uint64_t const match = timer_next + (uint64_t)(ticks - 1) * timer_div;
+		if (match < next) next = match;
+	}
+
+	uint64_t const now = host_cycles();
+	if (next <= now) return 0;
+	if (next == NEVER) return 1000000000;
+	return (next - now) * 1000000000 / F_CPU;
+}
+
+// The firmware goes to sleep when it has nothing to do. Interrupts
+// wake it up.
+void sleep_cpu(void)
+{
+	if (emu_quit) {
+		emu_shutdown();
+		exit(0);
+	}
+
+	if (hw_run(IRQS_PER_WAKEUP) > 0) return;
+
+	emu_eeprom_save(false);
+	emu_serial_wait(hw_next_irq_ns());
+}
+
+int64_t emu_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000l + ts.tv_nsec;
+}
+
+// Host time in CPU cycles. Splitting the seconds avoids overflows.
+static uint64_t host_cycles(void)
+{
+	int64_t const ns = emu_now_ns() - start_ns;
+	return (ns / 1000000000) * F_CPU + (ns % 1000000000) * F_CPU / 1000000000;
+}
+
+// Advance TIMER2 by one tick. Returns true if an interrupt handler
+// was called.
+static bool timer_tick(void)
+{
+	timer_next += timer_div;
+	TCNT2 = timer_count(TCNT2);
+	if (TCNT2 == OCR2A) timer_flags |= _BV(OCF2A);
+	if (TCNT2 == OCR2B) timer_flags |= _BV(OCF2B);
+
+	// Compare match A has the higher priority
+	bool ran = false;
+	if ((timer_flags & _BV(OCF2A)) && (TIMSK2 & _BV(OCIE2A))) {
+		timer_flags &= ~_BV(OCF2A);
+		TIMER2_COMPA_vect();
+		ran = true;
+	}
+	if ((timer_flags & _BV(OCF2B)) && (TIMSK2 & _BV(OCIE2B))) {
+		timer_flags &= ~_BV(OCF2B);
+		TIMER2_COMPB_vect();
+		ran = true;
+	}
+	return ran;
+}
+
+// Next counter value. In CTC mode the counter is cleared after
+// reaching OCR2A.
+static uint8_t timer_count(uint8_t const tcnt)
+{
+	bool const ctc = TCCR2A & _BV(WGM21);
+	return ctc && tcnt == OCR2A ? 0 : tcnt + 1;
+}
+
+// Ticks until the counter reaches the target. Returns 0x100 if it
+// never does.
+static uint16_t timer_ticks_until(uint8_t const target)
+{
+	uint8_t tcnt = TCNT2;
+	for (uint16_t ticks = 1; ticks < 0x100; ticks++) {
+		tcnt = timer_count(tcnt);
+		if (tcnt == target) return ticks;
+	}
+	return 0x100;
+}
+
+// Start or stop TIMER2 when the clock select bits change.
+static void timer_update_prescaler(void)
+{
+	static uint16_t const divs[] = {0, 1, 8, 32, 64, 128, 256, 1024};
+	uint16_t const div = divs[TCCR2B & 0b111];
+	if (div == timer_div) return;
+
+	timer_div = div;
+	timer_next = div == 0 ? NEVER : cycle + div;
+}
+
+// Start a conversion when the firmware has set ADSC.
+static void adc_check_start(void)
+{
+	if (adc_done != NEVER) return;
+	if (!(ADCSRA & _BV(ADEN)) || !(ADCSRA & _BV(ADSC))) return;
+
+	// ADPS bits select the prescaler, both 0 and 1 mean 2.
+	uint8_t const adps = ADCSRA & 0b111;
+	uint16_t const div = adps == 0 ? 2 : 1 << adps;
+	adc_done = cycle + ADC_CONVERSION * div;
+}
+
+// Finish the conversion. Returns true if the interrupt handler was
+// called.
+static bool adc_complete(void)
+{
+	adc_done = NEVER;
+	ADCW = adc_sample(ADMUX & 0b1111);
+	ADCSRA &= ~_BV(ADSC);
+
+	if (!(ADCSRA & _BV(ADIE))) {
+		ADCSRA |= _BV(ADIF);
+		return false;
+	}
+	ADCSRA &= ~_BV(ADIF);
+	ADC_vect();
+	return true;
+}
+
+// Sample the simulated analog input of the channel.
+static uint16_t adc_sample(uint8_t const channel)
+{
+	float mv;
+	switch (channel) {
+	case LINE_K5_ADC:
+		mv = line_sample(0, IS_OUTPUT(LINE_K5_PIN) && !STATE(LINE_K5_PIN));
+		break;
+#ifdef LINE_K9_ADC
+	case LINE_K9_ADC:
+		mv = line_sample(1, IS_OUTPUT(LINE_K9_PIN) && !STATE(LINE_K9_PIN));
+		break;
+#endif
+	case 2: mv = error_lit() ? emu_analog.error : 0; break;
+	case 3: mv = emu_analog.outside; break;
+	case 4: mv = emu_analog.accumulator; break;
+	case 8: mv = emu_analog.int_temp; break;
+	default: mv = 0;
+	}
+
+	// Some noise in the least significant bit
+	noise = noise * 1103515245 + 12345;
+	int32_t const raw = mv * 1024 / ADC_REF + (int32_t)(noise >> 30) % 3 - 1;
+	return raw < 0 ? 0 : raw > 1023 ? 1023 : raw;
+}
+
+// Advance the juksautus line to the current cycle and get its voltage.
+// The line is a capacitor which is charged by the heat pump controller
+// via the thermistor and discharged when the drive pin is pulled down.
+// The pin changes only after the line has been sampled.
+static float line_sample(uint8_t const line, bool const pulled)
+{
+	float const dt_us = (float)(cycle - line_updated[line]) * 1000000 / F_CPU;
+	float const goal = pulled ? 0 : emu_analog.k5;
+	float const tau = pulled ? LINE_FALL_US : LINE_RISE_US;
+	line_mv[line] += (goal - line_mv[line]) * (dt_us < tau ? dt_us / tau : 1);
+	line_updated[line] = cycle;
+	return line_mv[line];
+}
+
+// Is the error LED lit at the moment?
+static bool error_lit(void)
+{
+	if (emu_analog.blinks == 0) return true;
+	uint32_t const group_ms = emu_analog.blinks * BLINK_PERIOD_MS + BLINK_PAUSE_MS;
+	uint32_t const ms = cycle / (F_CPU / 1000) % group_ms;
+	return ms < emu_analog.blinks * BLINK_PERIOD_MS &&
+		ms % BLINK_PERIOD_MS < BLINK_PERIOD_MS / 2;
+}
@@ -0,0 +1,117 @@
+// Pumpunjuksautin emulator for the host.
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Runs the firmware on the host with its serial port on a
+// pseudo-terminal. Sets up the emulated hardware and then calls the
+// firmware main().
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include "emu.h"
+
+// Default silence between frames in microseconds
+#define DEFAULT_SILENCE 200
+
+volatile bool emu_quit = false;
+
+static void on_signal(int signo);
+static void usage(char const *name);
+
+int main(int argc, char **argv)
+{
+	char const *link = NULL;
+	char const *eeprom = NULL;
+	uint32_t silence = DEFAULT_SILENCE;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "l:e:s:k:a:o:E:b:")) != -1) {
+		switch (opt) {
+		case 'l':
+			link = optarg;
+			break;
+		case 'e':
+			eeprom = optarg;
+			break;
+		case 's':
+			silence = atol(optarg);
+			break;
+		case 'k':
+			emu_analog.k5 = atoi(optarg);
+			break;
+		case 'a':
+			emu_analog.accumulator = atoi(optarg);
+			break;
+		case 'o':
+			emu_analog.outside = atoi(optarg);
+			break;
+		case 'E':
+			emu_analog.error = atoi(optarg);
+			break;
+		case 'b':
+			emu_analog.blinks = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc) usage(argv[0]);
+
+	// Save the state when terminated. No SA_RESTART so the wait
+	// for the serial port is interrupted.
+	struct sigaction sa = { .sa_handler = on_signal };
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	emu_eeprom_load(eeprom);
+	emu_serial_open(link, silence);
+	hw_init();
+	return firmware_main();
+}
+
+void emu_shutdown(void)
+{
+	emu_eeprom_save(true);
+	emu_serial_close();
+}
+
+static void on_signal(int signo)
+{
+	emu_quit = true;
+}
+
+static void usage(char const *name)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTIONS]\n"
+		"\n"
+		"Runs Pumpunjuksautin firmware on a pseudo-terminal. Prints the\n"
+		"terminal path to stdout.\n"
+		"\n"
+		"  -l PATH  Create a symlink to the terminal\n"
+		"  -e FILE  Keep EEPROM contents in FILE. Default: not saved\n"
+		"  -s USEC  Silence between frames in microseconds. Default: %d\n"
+		"  -k MV    Line voltage without juksautus. Default: %d\n"
+		"  -a MV    Accumulator tank sensor voltage. Default: %d\n"
+		"  -o MV    Outside temperature sensor voltage. Default: %d\n"
+		"  -E MV    Error LED voltage. Default: %d\n"
+		"  -b N     Blink the error LED N times in a group. Default: steady\n",
+		name, DEFAULT_SILENCE, emu_analog.k5, emu_analog.accumulator,
+		emu_analog.outside, emu_analog.error);
+	exit(1);
+}
@@ -0,0 +1,159 @@
+// Pumpunjuksautin microbenchmark of ASCII interface kernels.
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// The firmware source is included to reach its static functions. It
+// is left out from the firmware sources of this program.
+#include "interface/ascii.c"
+#include "micro.h"
+
+// Room for the register names
+#define MAX_NAMES 64
+#define NAME_LEN 32
+
+static char names[2][MAX_NAMES][NAME_LEN]; // Register names as typed and in upper case
+static int names_len = 0;
+
+// Declared by the generated command table
+cmd_scan_t cmd_scan_int32;
+
+static uint32_t scanned = 0;
+
+// Copy the register names from the command table.
+static void collect_names(void)
+{
+	if (names_len != 0) return;
+	for (int i = 0; i < cmd_ascii_len && i < MAX_NAMES; i++) {
+		char const *name = pgm_read_ptr_near(&cmd_ascii[i].name);
+		strlcpy_P(names[0][i], name, NAME_LEN);
+		for (int j = 0; j < NAME_LEN; j++) {
+			names[1][i][j] = toupper(names[0][i][j]);
+		}
+		names_len++;
+	}
+}
+
+static uint32_t find(uint64_t const n, int const variant)
+{
+	uint32_t acc = 0;
+	int j = 0;
+	collect_names();
+	for (uint64_t i = 0; i < n; i++) {
+		acc += find_cmd(names[variant][j]) != NULL;
+		if (++j == names_len) j = 0;
+	}
+	return acc;
+}
+
+static uint32_t find_all(uint64_t const n)
+{
+	return find(n, 0);
+}
+
+static uint32_t find_all_upper(uint64_t const n)
+{
+	return find(n, 1);
+}
+
+static uint32_t find_missing(uint64_t const n)
+{
+	uint32_t acc = 0;
+	for (uint64_t i = 0; i < n; i++) {
+		acc += find_cmd("no_such_register") != NULL;
+	}
+	return acc;
+}
+
+static modbus_status_t set_scanned(int32_t const value)
+{
+	scanned += value;
+	return MODBUS_OK;
+}
+
+static uint32_t scan(uint64_t const n, char const *const input)
+{
+	char buf[SERIAL_RX_LEN];
+	uint32_t acc = 0;
+	strlcpy(buf, input, sizeof(buf));
+	for (uint64_t i = 0; i < n; i++) {
+		acc += cmd_scan_int32(buf, set_scanned).error_msg == NULL;
+	}
+	return acc + scanned;
+}
+
+static uint32_t scan_short(uint64_t const n)
+{
+	return scan(n, "21");
+}
+
+static uint32_t scan_min(uint64_t const n)
+{
+	return scan(n, "-2147483648");
+}
+
+static uint32_t scan_hex(uint64_t const n)
+{
+	return scan(n, "0x7fffffff");
+}
+
+static uint32_t scan_invalid(uint64_t const n)
+{
+	return scan(n, "12a");
+}
+
+// Formats an error at the given position of a full input line
+static uint32_t error(uint64_t const n, buflen_t const pos, char const *const msg)
+{
+	char line[SERIAL_RX_LEN];
+	memset(line, 'x', sizeof(line));
+	cmd_result_t const e = { line + pos, msg, 0 };
+
+	uint32_t acc = 0;
+	for (uint64_t i = 0; i < n; i++) {
+		location_aware_error(line, &e);
+		acc += serial_tx[0];
+	}
+	return acc;
+}
+
+static uint32_t error_caret(uint64_t const n)
+{
+	return error(n, 10, PSTR("Not a digit"));
+}
+
+static uint32_t error_before_caret(uint64_t const n)
+{
+	return error(n, 70, PSTR("Allowed values: 0, 1, ON, or OFF"));
+}
+
+static uint32_t error_position(uint64_t const n)
+{
+	return error(n, SERIAL_RX_LEN-1, PSTR("Not a digit"));
+}
+
+micro_case_t const micro_ascii[] = {
+	{ "ascii find_cmd", "every register", find_all },
+	{ "ascii find_cmd", "every register in upper case", find_all_upper },
+	{ "ascii find_cmd", "missing register", find_missing },
+	{ "cmd_scan_int32", "21", scan_short },
+	{ "cmd_scan_int32", "-2147483648", scan_min },
+	{ "cmd_scan_int32", "0x7fffffff", scan_hex },
+	{ "cmd_scan_int32", "12a", scan_invalid },
+	{ "location_aware_error", "caret at 10", error_caret },
+	{ "location_aware_error", "message before caret at 70", error_before_caret },
+	{ "location_aware_error", "no room for caret at 79", error_position },
+	{ NULL }
+};
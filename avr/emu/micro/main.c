@@ -0,0 +1,157 @@
+// Pumpunjuksautin microbenchmark on the host.
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Times the hot kernels of the firmware and JuksUtil, compiled for
+// the host from the same sources as juksemu. Prints the time and
+// the number of heap allocations per operation as TSV.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../emu.h"
+#include "micro.h"
+
+// Default time of a measurement in milliseconds and the number of
+// measurements. The fastest one is reported.
+#define DEFAULT_TIME_MS 200
+#define DEFAULT_REPEATS 5
+
+// Iterations are doubled until a round takes this long. Then the
+// count is scaled to the measurement time.
+#define CALIBRATION_NS 10000000
+
+static micro_case_t const *const suites[] = {
+	micro_modbus,
+	micro_ascii,
+	micro_tz,
+};
+
+static uint64_t allocs = 0;
+static volatile uint32_t sink;
+
+static int64_t timed(micro_case_t const *c, uint64_t n);
+static void measure(micro_case_t const *c, int64_t time_ns, int repeats);
+static void usage(char const *name);
+
+// Heap allocations are counted by wrapping the glibc allocator. This
+// catches the allocations inside the libraries, too.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t const size)
+{
+	allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t const nmemb, size_t const size)
+{
+	allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *const ptr, size_t const size)
+{
+	allocs++;
+	return __libc_realloc(ptr, size);
+}
+
+// The emulated hardware is linked in but never sleeps here
+volatile bool emu_quit = false;
+
+void emu_shutdown(void)
+{
+}
+
+int main(int argc, char **argv)
+{
+	char const *filter = NULL;
+	int64_t time_ns = DEFAULT_TIME_MS * 1000000l;
+	int repeats = DEFAULT_REPEATS;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "k:t:r:")) != -1) {
+		switch (opt) {
+		case 'k':
+			filter = optarg;
+			break;
+		case 't':
+			time_ns = atol(optarg) * 1000000l;
+			break;
+		case 'r':
+			repeats = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || time_ns <= 0 || repeats <= 0) usage(argv[0]);
+
+	printf("kernel\tinput\tns/op\tallocs/op\n");
+	for (size_t i = 0; i < sizeof(suites) / sizeof(*suites); i++) {
+		for (micro_case_t const *c = suites[i]; c->kernel != NULL; c++) {
+			if (filter != NULL && strstr(c->kernel, filter) == NULL) continue;
+			measure(c, time_ns, repeats);
+		}
+	}
+	return 0;
+}
+
+static int64_t timed(micro_case_t const *const c, uint64_t const n)
+{
+	int64_t const start = emu_now_ns();
+	sink += c->run(n);
+	return emu_now_ns() - start;
+}
+
+static void measure(micro_case_t const *const c, int64_t const time_ns, int const repeats)
+{
+	// Calibration also runs the lazy initialization of the case
+	uint64_t n = 1;
+	int64_t took;
+	while ((took = timed(c, n)) < CALIBRATION_NS) n *= 2;
+	n = n * time_ns / took;
+	if (n == 0) n = 1;
+
+	uint64_t const allocs_start = allocs;
+	double best = 0;
+	for (int i = 0; i < repeats; i++) {
+		double const ns = (double)timed(c, n) / n;
+		if (i == 0 || ns < best) best = ns;
+	}
+
+	printf("%s\t%s\t%.1f\t%.2f\n", c->kernel, c->input, best,
+	       (double)(allocs - allocs_start) / (n * repeats));
+	fflush(stdout);
+}
+
+static void usage(char const *name)
+{
+	fprintf(stderr,
+		"Usage: %s [OPTIONS]\n"
+		"\n"
+		"Times the hot kernels of the firmware and JuksUtil on the host.\n"
+		"Prints nanoseconds and heap allocations per operation as TSV.\n"
+		"\n"
+		"  -k NAME  Run only the kernels with NAME in their name\n"
+		"  -t MS    Time of a measurement in milliseconds. Default: %d\n"
+		"  -r N     Number of measurements, the fastest is reported. Default: %d\n",
+		name, DEFAULT_TIME_MS, DEFAULT_REPEATS);
+	exit(1);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+// Host microbenchmark of the hot kernels. Each kernel source
+// provides a table of cases terminated by an empty entry.
+
+#include <stdint.h>
+
+// Runs the kernel n times. Returns something derived from the
+// results so the compiler can't drop the work.
+typedef uint32_t micro_run_t(uint64_t n);
+
+typedef struct {
+	char const *kernel; // Function under test
+	char const *input;  // Description of the input
+	micro_run_t *run;
+} micro_case_t;
+
+extern micro_case_t const micro_modbus[];
+extern micro_case_t const micro_ascii[];
+extern micro_case_t const micro_tz[];
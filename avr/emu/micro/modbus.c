@@ -0,0 +1,90 @@
+// Pumpunjuksautin microbenchmark of Modbus kernels.
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// The firmware source is included to reach its static functions. It
+// is left out from the firmware sources of this program.
+#include "interface/modbus.c"
+#include "micro.h"
+
+// Typical read request and the longest response, without CRC
+#define REQUEST_LEN 6
+#define RESPONSE_LEN (SERIAL_TX_LEN-2)
+
+static char frame[RESPONSE_LEN];
+
+static void fill_frame(void)
+{
+	uint32_t x = 1;
+	for (int i = 0; i < RESPONSE_LEN; i++) {
+		x = x * 1103515245 + 12345;
+		frame[i] = x >> 24;
+	}
+}
+
+// The first byte changes every time so the compiler can't compute
+// the CRC only once.
+static uint32_t crc(uint64_t const n, buflen_t const len)
+{
+	uint32_t acc = 0;
+	fill_frame();
+	for (uint64_t i = 0; i < n; i++) {
+		frame[0] = i;
+		acc += modbus_crc(frame, len);
+	}
+	return acc;
+}
+
+static uint32_t crc_request(uint64_t const n)
+{
+	return crc(n, REQUEST_LEN);
+}
+
+static uint32_t crc_response(uint64_t const n)
+{
+	return crc(n, RESPONSE_LEN);
+}
+
+// Looks up every register in the table in turn
+static uint32_t find_all(uint64_t const n)
+{
+	uint32_t acc = 0;
+	int j = 0;
+	for (uint64_t i = 0; i < n; i++) {
+		modbus_object_t const type = pgm_read_byte_near(&cmd_modbus[j].type);
+		uint16_t const addr = pgm_read_word_near(&cmd_modbus[j].addr);
+		acc += find_cmd(type, addr) != NULL;
+		if (++j == cmd_modbus_len) j = 0;
+	}
+	return acc;
+}
+
+static uint32_t find_missing(uint64_t const n)
+{
+	uint32_t acc = 0;
+	for (uint64_t i = 0; i < n; i++) {
+		acc += find_cmd(HOLDING_REGISTER, 0xffff) != NULL;
+	}
+	return acc;
+}
+
+micro_case_t const micro_modbus[] = {
+	{ "modbus_crc", "6 byte request", crc_request },
+	{ "modbus_crc", "78 byte response", crc_response },
+	{ "modbus find_cmd", "every register", find_all },
+	{ "modbus find_cmd", "missing register", find_missing },
+	{ NULL }
+};
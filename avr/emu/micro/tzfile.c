@@ -0,0 +1,91 @@
+// Pumpunjuksautin microbenchmark of JuksUtil time zone kernels.
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// JuksUtil source is included to reach its static functions. This
+// file is compiled without the avr-libc shims.
+#include <err.h>
+#include "tz.c"
+#include "micro.h"
+
+// Reference time, 2023-11-14
+#define NOW 1700000000
+
+typedef struct {
+	char const *name;
+	mmap_info_t file;
+	char *v2;          // Version 2 header
+	int len;           // Bytes from the version 2 header to the end
+} zone_t;
+
+static zone_t helsinki = { "Europe/Helsinki" };
+static zone_t montevideo = { "America/Montevideo" };
+static zone_t sydney = { "Australia/Sydney" };
+static zone_t utc = { "UTC" };
+
+// Map the zone file on the first run. It is kept open.
+static void open_zone(zone_t *const zone)
+{
+	if (zone->v2 != NULL) return;
+	if (!mmap_zonefile(zone->name, &zone->file)) {
+		err(1, "Unable to open zone %s", zone->name);
+	}
+	zone->v2 = find_v2_header(zone->file.data, zone->file.length);
+	if (zone->v2 == NULL) {
+		errx(1, "Zone %s has no version 2 data", zone->name);
+	}
+	zone->len = (char *)zone->file.data + zone->file.length - zone->v2;
+}
+
+static uint32_t next_transition(uint64_t const n, zone_t *const zone)
+{
+	tzinfo_t info;
+	uint32_t acc = 0;
+	open_zone(zone);
+	for (uint64_t i = 0; i < n; i++) {
+		find_next_transition(&info, zone->v2, zone->len, NOW);
+		acc += info.table_len;
+	}
+	return acc;
+}
+
+static uint32_t next_helsinki(uint64_t const n)
+{
+	return next_transition(n, &helsinki);
+}
+
+static uint32_t next_montevideo(uint64_t const n)
+{
+	return next_transition(n, &montevideo);
+}
+
+static uint32_t next_sydney(uint64_t const n)
+{
+	return next_transition(n, &sydney);
+}
+
+static uint32_t next_utc(uint64_t const n)
+{
+	return next_transition(n, &utc);
+}
+
+micro_case_t const micro_tz[] = {
+	{ "find_next_transition", "Europe/Helsinki", next_helsinki },
+	{ "find_next_transition", "America/Montevideo", next_montevideo },
+	{ "find_next_transition", "Australia/Sydney", next_sydney },
+	{ "find_next_transition", "UTC", next_utc },
+	{ NULL }
+};
@@ -0,0 +1,93 @@
+// Pumpunjuksautin emulated EEPROM.
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Implements persist.h. The EEMEM variables are collected by the
+// linker to a section which acts as the EEPROM, so writes are just
+// copies. The section is saved to a file so the settings survive
+// restarts. The file layout depends on the build.
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include "../src/persist.h"
+#include "emu.h"
+
+// Save at most once per second
+#define SAVE_INTERVAL 1000000000
+
+// Section boundaries provided by the linker
+extern uint8_t __start_eeprom[];
+extern uint8_t __stop_eeprom[];
+
+static char const *eeprom_path = NULL;
+static bool dirty = false;
+static int64_t saved_at = 0;
+
+void persist_update(void *const ee_dst, void const *const src, uint8_t const len)
+{
+	memcpy(ee_dst, src, len);
+	dirty = true;
+}
+
+bool persist_is_busy(void)
+{
+	return false;
+}
+
+void emu_eeprom_load(char const *const path)
+{
+	// Erased EEPROM reads as ones
+	size_t const size = __stop_eeprom - __start_eeprom;
+	memset(__start_eeprom, 0xFF, size);
+
+	eeprom_path = path;
+	if (path == NULL) return;
+
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		if (errno == ENOENT) return;
+		err(1, "Unable to open %s", path);
+	}
+	if (fread(__start_eeprom, 1, size, f) != size) {
+		warnx("%s is from a different build, starting with erased EEPROM", path);
+		memset(__start_eeprom, 0xFF, size);
+	}
+	fclose(f);
+}
+
+void emu_eeprom_save(bool const force)
+{
+	if (!dirty || eeprom_path == NULL) return;
+	int64_t const now = emu_now_ns();
+	if (!force && now - saved_at < SAVE_INTERVAL) return;
+
+	// Write to a temporary file first to not lose the settings if
+	// interrupted.
+	char tmp[FILENAME_MAX];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", eeprom_path);
+	FILE *f = fopen(tmp, "wb");
+	if (f == NULL) err(1, "Unable to open %s", tmp);
+	size_t const size = __stop_eeprom - __start_eeprom;
+	if (fwrite(__start_eeprom, 1, size, f) != size || fclose(f)) {
+		err(1, "Unable to write %s", tmp);
+	}
+	if (rename(tmp, eeprom_path)) err(1, "Unable to rename %s", tmp);
+
+	dirty = false;
+	saved_at = now;
+}
@@ -0,0 +1,242 @@
+// Pumpunjuksautin serial port on a pseudo-terminal.
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Implements serial.h on top of a pseudo-terminal. Frames are
+// separated by silence like on the device, but the silence is
+// measured in host time and is much shorter than on a real line so
+// the clients can run at full speed. Transmission is immediate, so
+// the firmware never sees the transmitter busy. A pseudo-terminal has
+// no line errors.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include "../src/serial.h"
+#include "emu.h"
+
+char serial_tx[SERIAL_TX_LEN]; // Outgoing serial data
+
+static char rx[SERIAL_RX_LEN+1]; // Receive buffer with room for NUL
+static buflen_t rx_i = 0;        // Receive buffer position, ~0 on overflow
+static bool rx_active = false;   // Receiving a frame
+static bool rx_ready = false;    // Frame waiting for the main loop
+static int64_t rx_last;          // Time of the latest received byte
+
+static int master = -1;
+static int slave = -1;
+static char const *link_path = NULL;
+static int64_t silence_ns;
+
+static serial_counter_t counts = {0, 0, 0};
+
+static void receive(char const *buf, ssize_t len);
+
+void emu_serial_open(char const *const link, uint32_t const silence_us)
+{
+	// Non-blocking so the emulator doesn't get stuck if nobody
+	// reads the responses.
+	master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (master == -1 || grantpt(master) || unlockpt(master)) {
+		err(1, "Unable to create pseudo-terminal");
+	}
+	char const *const name = ptsname(master);
+
+	// Keep the slave open so the master doesn't hang up between
+	// clients. Raw mode prevents echoing the responses back.
+	slave = open(name, O_RDWR | O_NOCTTY);
+	if (slave == -1) err(1, "Unable to open %s", name);
+	struct termios tio;
+	tcgetattr(slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+
+	if (link != NULL) {
+		unlink(link);
+		if (symlink(name, link)) err(1, "Unable to create link %s", link);
+		link_path = link;
+	}
+
+	silence_ns = silence_us * 1000l;
+	printf("%s\n", link == NULL ? name : link);
+	fflush(stdout);
+}
+
+void emu_serial_close(void)
+{
+	if (link_path != NULL) unlink(link_path);
+}
+
+void emu_serial_wait(int64_t timeout_ns)
+{
+	// Don't read the next frame before the previous is processed.
+	// The pseudo-terminal buffers the data meanwhile.
+	struct pollfd fds = { master, rx_ready ? 0 : POLLIN, 0 };
+
+	int64_t const now = emu_now_ns();
+	if (rx_active && rx_last + silence_ns - now < timeout_ns) {
+		timeout_ns = rx_last + silence_ns - now;
+		if (timeout_ns < 0) timeout_ns = 0;
+	}
+
+	struct timespec const ts = { timeout_ns / 1000000000, timeout_ns % 1000000000 };
+	int const ret = ppoll(&fds, 1, &ts, NULL);
+	if (ret == -1 && errno != EINTR) err(1, "poll failed");
+
+	if (ret > 0 && (fds.revents & POLLIN)) {
+		char buf[SERIAL_RX_LEN];
+		ssize_t const len = read(master, buf, sizeof(buf));
+		if (len == -1 && errno != EAGAIN && errno != EINTR) {
+			err(1, "Unable to read pseudo-terminal");
+		}
+		receive(buf, len);
+	}
+
+	// End of frame
+	if (rx_active && emu_now_ns() - rx_last >= silence_ns) {
+		rx_active = false;
+		rx_ready = true;
+		if (rx_i > SERIAL_RX_LEN) {
+			counts.too_long_rx++;
+		} else {
+			counts.good++;
+		}
+	}
+}
+
+static void receive(char const *const buf, ssize_t const len)
+{
+	if (len <= 0) return;
+
+	// The protocols are half-duplex, so at the start of a request
+	// anything unread is left over from a client which has gone
+	// away.
+	if (!rx_active) tcflush(slave, TCIFLUSH);
+	rx_active = true;
+	rx_last = emu_now_ns();
+
+	for (ssize_t i = 0; i < len; i++) {
+		if (rx_i >= SERIAL_RX_LEN) {
+			// Overflow. Marking the index as invalid.
+			rx_i = ~0;
+			return;
+		}
+		rx[rx_i++] = buf[i];
+	}
+}
+
+void serial_init(void)
+{
+	// The pseudo-terminal is opened before starting the firmware
+}
+
+bool serial_is_transmitting(void)
+{
+	return false;
+}
+
+buflen_t serial_get_message(char **const buf)
+{
+	if (!rx_ready) {
+		*buf = NULL;
+		return 0;
+	}
+	if (rx_i <= SERIAL_RX_LEN) rx[rx_i] = '\0';
+	*buf = rx;
+	return rx_i;
+}
+
+void serial_free_message(void)
+{
+	rx_ready = false;
+	rx_i = 0;
+}
+
+void serial_tx_line(void)
+{
+	// Search for terminating NUL.
+	buflen_t len = strnlen(serial_tx, SERIAL_TX_LEN);
+
+	// Not going to send any data which is not NULL terminated.
+	if (len == SERIAL_TX_LEN) {
+		counts.too_long_tx++;
+		return;
+	}
+
+	// The message might have been cut. Indicate it with '>' sign.
+	if (len+1 >= SERIAL_TX_LEN) {
+		serial_tx[SERIAL_TX_LEN-2] = '>';
+	}
+
+	// Place newline at the end (overriding NUL) and send it.
+	serial_tx[len] = '\n';
+	serial_tx_bin(len+1);
+}
+
+void serial_tx_bin(buflen_t const len)
+{
+	if (len > SERIAL_TX_LEN) {
+		counts.too_long_tx++;
+		return;
+	}
+
+	buflen_t pos = 0;
+	while (pos < len) {
+		ssize_t const wrote = write(master, serial_tx + pos, len - pos);
+		if (wrote == -1) {
+			if (errno == EINTR) continue;
+			// Nobody is listening. Drop the rest like a
+			// real line would.
+			if (errno == EAGAIN) return;
+			err(1, "Unable to write pseudo-terminal");
+		}
+		pos += wrote;
+	}
+}
+
+serial_counter_t pull_serial_counters(void)
+{
+	serial_counter_t const ret = counts;
+	memset(&counts, 0, sizeof(counts));
+	return ret;
+}
+
+uint16_t serial_get_framing_errors(void)
+{
+	return 0;
+}
+
+uint16_t serial_get_overruns(void)
+{
+	return 0;
+}
+
+uint16_t serial_get_parity_errors(void)
+{
+	return 0;
+}
+
+uint16_t serial_get_breaks(void)
+{
+	return 0;
+}
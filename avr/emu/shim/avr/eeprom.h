@@ -0,0 +1,19 @@
+#pragma once
+
+// EEMEM variables are the emulated EEPROM. They are collected to a
+// section which persist.c loads from and saves to a file.
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM __attribute__((section("eeprom")))
+
+static inline void eeprom_read_block(void *dst, void const *src, size_t n)
+{
+	memcpy(dst, src, n);
+}
+
+static inline uint8_t eeprom_read_byte(uint8_t const *p)
+{
+	return *p;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+// The emulator calls interrupt handlers from the main loop when the
+// firmware sleeps, so they never preempt anything and the interrupt
+// flag doesn't need to be emulated.
+
+#include <avr/io.h>
+
+#define sei()
+#define cli()
+
+// Interrupt handlers are plain functions called by hw.c.
+#define ISR(vector, ...) void vector(void); void vector(void)
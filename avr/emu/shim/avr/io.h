@@ -0,0 +1,39 @@
+#pragma once
+
+// Registers of ATmega328p used by the firmware. They are plain
+// variables which are read and written by the emulated peripherals in
+// hw.c between the interrupts.
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+// Ports
+extern volatile uint8_t DDRB, PORTB, PINB;
+extern volatile uint8_t DDRC, PORTC, PINC;
+extern volatile uint8_t DDRD, PORTD, PIND;
+
+// TIMER2
+extern volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B, TIMSK2, TIFR2;
+#define WGM21 1
+#define OCIE2A 1
+#define OCIE2B 2
+#define OCF2A 1
+#define OCF2B 2
+
+// TIMER1, a cycle counter for the statistics
+extern volatile uint8_t TCCR1A, TCCR1B;
+extern volatile uint16_t TCNT1;
+#define CS10 0
+
+// Reset cause
+extern volatile uint8_t MCUSR;
+#define PORF 0
+
+// ADC
+extern volatile uint8_t ADMUX, ADCSRA, ADCSRB;
+extern volatile uint16_t ADCW;
+#define ADEN 7
+#define ADSC 6
+#define ADIF 4
+#define ADIE 3
@@ -0,0 +1,70 @@
+#pragma once
+
+// Program memory is ordinary memory on the host.
+
+#include <stddef.h>
+#include <avr/io.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+
+#define pgm_read_byte(p) (*(uint8_t const *)(p))
+#define pgm_read_word(p) (*(uint16_t const *)(p))
+#define pgm_read_dword(p) (*(uint32_t const *)(p))
+#define pgm_read_ptr(p) (*(void * const *)(p))
+#define pgm_read_byte_near pgm_read_byte
+#define pgm_read_word_near pgm_read_word
+#define pgm_read_dword_near pgm_read_dword
+#define pgm_read_ptr_near pgm_read_ptr
+
+#define memcpy_P memcpy
+#define memcmp_P memcmp
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcasecmp_P strcasecmp
+#define strncasecmp_P strncasecmp
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strlcpy_P strlcpy
+#define strlen_P strlen
+#define strnlen_P strnlen
+#define sscanf_P sscanf
+
+// avr-libc formats PROGMEM strings with %S. Those are ordinary
+// strings on the host, so %S is changed to %s.
+static inline void progmem_format(char *dst, char const *fmt)
+{
+	bool spec = false;
+	for (; *fmt != '\0'; fmt++) {
+		char c = *fmt;
+		if (!spec) {
+			spec = c == '%';
+		} else if (c == '%') {
+			spec = false;
+		} else if (isalpha(c) && !strchr("hlLqjzt", c)) {
+			if (c == 'S') c = 's';
+			spec = false;
+		}
+		*dst++ = c;
+	}
+	*dst = '\0';
+}
+
+static inline int snprintf_P(char *s, size_t n, char const *fmt, ...)
+{
+	char host_fmt[strlen(fmt) + 1];
+	progmem_format(host_fmt, fmt);
+	va_list ap;
+	va_start(ap, fmt);
+	int const ret = vsnprintf(s, n, host_fmt, ap);
+	va_end(ap);
+	return ret;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+// Sleeping runs the emulated peripherals and waits for the serial
+// port, see hw.c.
+
+#define sleep_enable()
+#define sleep_disable()
+
+void sleep_cpu(void);
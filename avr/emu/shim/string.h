@@ -0,0 +1,18 @@
+#pragma once
+
+// avr-libc has strlcpy(), older host C libraries don't.
+
+#include_next <string.h>
+
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+static inline size_t strlcpy(char *dst, char const *src, size_t size)
+{
+	size_t const len = strlen(src);
+	if (size != 0) {
+		size_t const n = len < size ? len : size - 1;
+		memcpy(dst, src, n);
+		dst[n] = '\0';
+	}
+	return len;
+}
+#endif
@@ -0,0 +1,35 @@
+#pragma once
+
+// avr-libc time interface on top of the host <time.h>. AVR time_t is
+// 32 bits wide and counts seconds from 2000-01-01 UTC. The system
+// time is advanced by system_tick() like on the device. Implemented
+// in emu/time.c.
+
+#include_next <time.h>
+#include <stdint.h>
+
+typedef uint32_t avr_time_t;
+#define time_t avr_time_t
+
+#define UNIX_OFFSET 946684800
+#define ONE_HOUR 3600
+
+#define time(timer) avr_time(timer)
+#define localtime(timer) avr_localtime(timer)
+#define gmtime(timer) avr_gmtime(timer)
+
+// avr-libc counts the terminating NUL in the return value
+static inline size_t avr_strftime(char *s, size_t max, char const *fmt, struct tm const *tm)
+{
+	size_t const len = strftime(s, max, fmt, tm);
+	return len == 0 ? 0 : len + 1;
+}
+#define strftime avr_strftime
+
+time_t avr_time(time_t *timer);
+struct tm *avr_localtime(time_t const *timer);
+struct tm *avr_gmtime(time_t const *timer);
+void set_system_time(time_t timestamp);
+void system_tick(void);
+void set_zone(int32_t zone);
+void set_dst(int (*d)(time_t const *timer, int32_t *z));
@@ -0,0 +1,11 @@
+#pragma once
+
+// Interrupts never preempt the code in the emulator, so atomic blocks
+// are just blocks.
+
+#include <avr/interrupt.h>
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+
+#define ATOMIC_BLOCK(type) for (int _atomic_once = 1; _atomic_once; _atomic_once = 0)
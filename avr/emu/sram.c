@@ -0,0 +1,49 @@
+// Pumpunjuksautin SRAM instrumentation on the host.
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Host memory layout tells nothing about the device, so the sizes
+// read as zero. Interrupt nesting is tracked as on the device but the
+// emulated handlers never nest.
+
+#include "../src/sram.h"
+
+uint8_t sram_nesting = 0;
+uint8_t sram_nesting_max = 0;
+
+void sram_tick(void)
+{
+}
+
+uint16_t sram_get_stack_free(void)
+{
+	return 0;
+}
+
+uint16_t sram_get_data_size(void)
+{
+	return 0;
+}
+
+uint16_t sram_get_bss_size(void)
+{
+	return 0;
+}
+
+uint16_t sram_get_nesting_max(void)
+{
+	return sram_nesting_max;
+}
@@ -0,0 +1,82 @@
+// Pumpunjuksautin emulated avr-libc time functions.
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// The system time is a counter advanced by system_tick() like in
+// avr-libc. Broken-down times are made by the host C library.
+
+#include <time.h>
+#include "emu.h"
+
+// Names as in avr-libc. clock.c reads __utc_offset.
+long __utc_offset = 0;
+static time_t system_time = 0;
+static int (*dst_ptr)(time_t const *timer, int32_t *z) = NULL;
+
+static struct tm *breakdown(time_t t, long offset);
+
+time_t avr_time(time_t *const timer)
+{
+	if (timer != NULL) *timer = system_time;
+	return system_time;
+}
+
+void set_system_time(time_t const timestamp)
+{
+	system_time = timestamp;
+}
+
+void system_tick(void)
+{
+	system_time++;
+}
+
+void set_zone(int32_t const zone)
+{
+	__utc_offset = zone;
+}
+
+void set_dst(int (*const d)(time_t const *timer, int32_t *z))
+{
+	dst_ptr = d;
+}
+
+struct tm *avr_gmtime(time_t const *const timer)
+{
+	return breakdown(*timer, 0);
+}
+
+struct tm *avr_localtime(time_t const *const timer)
+{
+	long offset = __utc_offset;
+	if (dst_ptr != NULL) {
+		int32_t z = __utc_offset;
+		offset += dst_ptr(timer, &z);
+	}
+	return breakdown(*timer, offset);
+}
+
+// Break down AVR time with the given UTC offset. The offset is also
+// stored to tm_gmtoff so strftime() can print it.
+static struct tm *breakdown(time_t const t, long const offset)
+{
+	static struct tm tm;
+	__time_t const host = (__time_t)t + UNIX_OFFSET + offset;
+	gmtime_r(&host, &tm);
+	tm.tm_gmtoff = offset;
+	tm.tm_zone = "";
+	return &tm;
+}
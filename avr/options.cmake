@@ -0,0 +1,74 @@
+# Firmware configuration. Included by the firmware build and the host
+# build in emu/ so both are built with the same options.
+
+## AVR Chip Configuration
+# 8Mhz, this should match the crystal on your board,
+# I use 8Mhz and 3.3V for the lowest power consumption
+set(F_CPU 16000000)
+# CPU, you can find the list here:
+# https://gcc.gnu.org/onlinedocs/gcc/AVR-Options.html
+set(MCU atmega328p)
+# Clock configuration. These values multiplied must equal to F_CPU to
+# make the clock tick once per second.
+set(CLOCK_A 250 CACHE STRING "Clock counter TOP value in OCR2A")
+set(CLOCK_B 250 CACHE STRING "Clock software divider")
+set(CLOCK_PRESCALER 256 CACHE STRING "Clock prescaler for TIMER2")
+
+# Default Baudrate for UART, read avr include/util/setbaud.h for usage
+set(BAUD 9600 CACHE STRING "Serial port baud rate")
+
+# Build options
+set(WITH_MODBUS ON CACHE BOOL "Enable Modbus RTU server support")
+set(WITH_ASCII ON CACHE BOOL "Enable ASCII point-to-point protocol")
+set(WITH_K9 OFF CACHE BOOL "Enable K9 juksautus line, not on hardware version 0.9")
+
+# Number of juksautus lines, passed to the command table generator
+if(WITH_K9)
+  set(JUKSAUTIN_LINES 2)
+else()
+  set(JUKSAUTIN_LINES 1)
+endif()
+
+# Measurement history. Buffer size is in bytes and a typical sample
+# takes 7 bytes.
+set(HISTORY_LEN 256 CACHE STRING "History buffer size in bytes")
+set(HISTORY_INTERVAL 10 CACHE STRING "History sampling interval in seconds")
+set(CAPTURE_LEN 128 CACHE STRING "Oscilloscope capture length in samples")
+
+message(STATUS "${MCU} running at ${F_CPU} Hz")
+
+# Sanity check to make sure the clock ticks once per second.
+math(EXPR clock_sanitycheck "${CLOCK_A} * ${CLOCK_B} * ${CLOCK_PRESCALER} - ${F_CPU}" OUTPUT_FORMAT DECIMAL)
+if(clock_sanitycheck)
+  message(SEND_ERROR "CLOCK_A * CLOCK_B * CLOCK_PRESCALER must equal to ${F_CPU}")
+endif()
+
+# MODBUS_SILENCE is the 14 bit long duration on the serial line,
+# measured in TIMER2 ticks. We consider a frame to be ready after 14
+# bits and after another 14 bits we can start transmitting.
+# https://en.wikipedia.org/wiki/Modbus#Modbus_RTU_frame_format_(primarily_used_on_asynchronous_serial_data_lines_like_RS-485/EIA-485)
+math(EXPR MODBUS_SILENCE "14 * ${F_CPU} / ${BAUD} / ${CLOCK_PRESCALER}" OUTPUT_FORMAT DECIMAL)
+message(STATUS "Modbus silence duration: ${MODBUS_SILENCE} ticks of TIMER2")
+if(MODBUS_SILENCE GREATER_EQUAL CLOCK_A)
+  message(SEND_ERROR "Modbus silence too long. Must be smaller than ${CLOCK_A}. Adjust baud rate or clock parameters.")
+endif()
+
+# Pass defines to compiler
+add_definitions(
+    -DF_CPU=${F_CPU}UL
+    -DCLOCK_A=${CLOCK_A}
+    -DCLOCK_B=${CLOCK_B}
+    -DCLOCK_PRESCALER=${CLOCK_PRESCALER}
+    -DBAUD=${BAUD}
+    -DMODBUS_SILENCE=${MODBUS_SILENCE}
+    -DWITH_MODBUS=$<BOOL:${WITH_MODBUS}>
+    -DWITH_ASCII=$<BOOL:${WITH_ASCII}>
+    -DWITH_K9=$<BOOL:${WITH_K9}>
+    -DHISTORY_LEN=${HISTORY_LEN}
+    -DHISTORY_INTERVAL=${HISTORY_INTERVAL}
+    -DCAPTURE_LEN=${CAPTURE_LEN}
+)
+
+message(STATUS "Modbus RTU server ${WITH_MODBUS}")
+message(STATUS "ASCII point-to-point protocol ${WITH_ASCII}")
+message(STATUS "K9 juksautus line ${WITH_K9}")
@@ -0,0 +1,26 @@
+# Static SRAM check. Fails the build if .data, .bss and .noinit leave
+# less than STACK_RESERVE bytes of RAM_SIZE for the stack. Run with
+# ELF, SIZE_TOOL, RAM_SIZE and STACK_RESERVE defined.
+EXECUTE_PROCESS(
+  COMMAND ${SIZE_TOOL} -A ${ELF}
+  OUTPUT_VARIABLE SIZE_OUTPUT
+  RESULT_VARIABLE SIZE_RESULT
+  )
+if (SIZE_RESULT)
+  message(FATAL_ERROR "Unable to read section sizes of ${ELF}")
+endif()
+
+set(STATIC_SRAM 0)
+foreach(SECTION data bss noinit)
+  set(${SECTION}_SIZE 0)
+  if (SIZE_OUTPUT MATCHES "\n\\.${SECTION} +([0-9]+)")
+    set(${SECTION}_SIZE ${CMAKE_MATCH_1})
+  endif()
+  math(EXPR STATIC_SRAM "${STATIC_SRAM} + ${${SECTION}_SIZE}")
+endforeach()
+
+math(EXPR STACK_LEFT "${RAM_SIZE} - ${STATIC_SRAM}")
+message(STATUS "SRAM: .data ${data_SIZE} + .bss ${bss_SIZE} + .noinit ${noinit_SIZE} = ${STATIC_SRAM} bytes, ${STACK_LEFT} left for the stack")
+if (STACK_LEFT LESS STACK_RESERVE)
+  message(FATAL_ERROR "Less than ${STACK_RESERVE} bytes left for the stack")
+endif()
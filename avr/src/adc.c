@@ -20,6 +20,8 @@
 #include <util/atomic.h>
 
 #include "adc.h"
+#include "sram.h"
+#include "stats.h"
 
 static adc_handler_t adc_handlers[9];
 
@@ -91,7 +93,9 @@ static void call_handler(uint8_t chan, uint16_t val)
 }
 
 // Interrupt service routine for the ADC completion
-ISR(ADC_vect) {
+STATS_ISR(ADC_vect, STATS_ADC) {
+	sram_isr_enter();
+
 	// Store the ADC port of previous measurement before changing it
 	uint8_t port = ADMUX & 0b00001111;
 
@@ -104,4 +108,5 @@ ISR(ADC_vect) {
 	// Enable interrupts while processing the data
 	sei();
 	call_handler(port, val);
+	sram_isr_exit();
 }
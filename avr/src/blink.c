@@ -0,0 +1,147 @@
+// Pumpunjuksautin heat pump error LED blink code decoder.
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdbool.h>
+#include <util/atomic.h>
+#include "blink.h"
+#include "clock.h"
+
+// Event queue length. Must be a power of two.
+#define QUEUE_LEN 8
+#define QUEUE_MASK (QUEUE_LEN - 1)
+
+// LED levels in raw ADC units with 1.1V reference. The gap between
+// them is hysteresis against noise.
+#define LEVEL_ON 280  // About 300 mV
+#define LEVEL_OFF 140 // About 150 mV
+
+// Durations in clock ticks
+#define PULSE_MIN CLOCK_MS(100)   // Shorter lit period is a glitch
+#define PULSE_MAX CLOCK_MS(1500)  // Longer lit period is steady light
+#define GAP_MIN CLOCK_MS(1500)    // Longer dark period ends the group
+#define CLEAR_MIN CLOCK_MS(10000) // Longer dark period clears the code
+
+typedef struct {
+	uint32_t time; // UNIX timestamp
+	uint8_t code;
+} event_t;
+
+static void set_code(uint8_t c);
+
+// Decoder state. Used only inside the ADC handler.
+static bool lit = false;  // Is the LED on?
+static uint32_t edge = 0; // Ticks at the latest edge
+static uint8_t blinks = 0; // Blinks in the current group
+
+// Written by the ADC handler, read in atomic blocks
+static volatile uint8_t code = BLINK_NONE;
+static event_t queue[QUEUE_LEN];
+static uint16_t next_seq = 0; // Sequence number of the next event
+static uint8_t count = 0;     // Number of stored events
+
+void blink_sample(uint16_t const val)
+{
+	uint32_t const now = clock_get_ticks();
+	uint32_t const span = now - edge;
+
+	if (lit ? val < LEVEL_OFF : val >= LEVEL_ON) {
+		// An edge ends the current period. Count the blink when
+		// the LED goes off.
+		lit = !lit;
+		edge = now;
+		if (!lit && span >= PULSE_MIN && span <= PULSE_MAX &&
+		    blinks < BLINK_STEADY - 1) {
+			blinks++;
+		}
+		return;
+	}
+
+	// The current period has lasted long enough to tell something
+	if (lit) {
+		if (span > PULSE_MAX) {
+			blinks = 0;
+			set_code(BLINK_STEADY);
+		}
+	} else if (span > CLEAR_MIN) {
+		set_code(BLINK_NONE);
+	} else if (span > GAP_MIN && blinks) {
+		set_code(blinks);
+		blinks = 0;
+	}
+}
+
+uint16_t blink_get_code(void)
+{
+	return code;
+}
+
+uint16_t blink_get_oldest(void)
+{
+	uint16_t oldest;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		oldest = next_seq - count;
+	}
+	return oldest;
+}
+
+uint16_t blink_get_count(void)
+{
+	uint8_t ret;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		ret = count;
+	}
+	return ret;
+}
+
+modbus_status_t blink_read(uint16_t const record, uint16_t *out, uint8_t const len)
+{
+	if (len % BLINK_EVENT_LEN != 0) {
+		return MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
+	}
+	uint8_t const events = len / BLINK_EVENT_LEN;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		// Position from the oldest event
+		uint16_t const skip = record - (uint16_t)(next_seq - count);
+		if (skip > count || events > count - skip) {
+			return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+		}
+
+		for (uint8_t i = 0; i < events; i++) {
+			event_t const *e = queue + ((record + i) & QUEUE_MASK);
+			*out++ = e->time >> 16;
+			*out++ = e->time;
+			*out++ = e->code;
+		}
+	}
+	return MODBUS_OK;
+}
+
+// Record a new code, if it has changed. Called from the ADC handler.
+static void set_code(uint8_t const c)
+{
+	if (c == code) return;
+	code = c;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		event_t *const e = queue + (next_seq & QUEUE_MASK);
+		e->time = clock_get_time_unix();
+		e->code = c;
+		next_seq++;
+		if (count < QUEUE_LEN) count++;
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+/*
+  Heat pump error LED blink code decoder
+
+  The heat pump controller reports faults by blinking its error LED N
+  times and then pausing, repeating the pattern as long as the fault
+  is active. The decoder follows the LED level from the ADC handler,
+  measures the durations of the on and off periods and counts the
+  blinks of each group.
+
+  A change in the code is recorded as a timestamped event to a small
+  queue so the master can read the events at leisure. Events have
+  16-bit sequence numbers, wrapping around. The oldest events are
+  thrown away when the queue fills up. Each event is BLINK_EVENT_LEN
+  registers:
+
+    time   2 registers   UNIX timestamp of the change, big-endian
+    code   1 register    The new code, see below
+*/
+
+#include <stdint.h>
+#include "modbus_types.h"
+
+// Number of registers in an event.
+#define BLINK_EVENT_LEN 3
+
+// Code values other than the number of blinks.
+#define BLINK_NONE 0     // LED has been off for a while
+#define BLINK_STEADY 255 // LED is lit continuously
+
+// Feed a raw ADC sample of the error LED. Called from the ADC
+// interrupt handler.
+void blink_sample(uint16_t val);
+
+// The latest decoded code.
+uint16_t blink_get_code(void);
+
+// Sequence number of the oldest stored event.
+uint16_t blink_get_oldest(void);
+
+// Number of stored events.
+uint16_t blink_get_count(void);
+
+// Reads the events starting from the sequence number given as the
+// record number. count must be a multiple of BLINK_EVENT_LEN and the
+// events must be stored.
+modbus_status_t blink_read(uint16_t record, uint16_t *out, uint8_t count);
@@ -15,35 +15,69 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
-#include <util/atomic.h>
+#include <string.h>
 #include <avr/eeprom.h>
+#include <util/atomic.h>
 #include "clock.h"
+#include "config.h"
+#include "persist.h"
+#include "sram.h"
+#include "stats.h"
 
 // avr_libc internal variable
 extern const long __utc_offset;
 
 static int unixy_dst(const time_t *time, int32_t *z);
-static void update_tzdata_from_eeprom(void);
+static int32_t gmtoff_at(time_t const *time);
+static void set_base_zone(void);
+static uint32_t ticks_now(void);
+static bool is_due(uint32_t deadline, uint32_t now);
+static void insert(clock_timer_t *t);
+static void unlink(clock_timer_t *t);
+static void reprogram(uint32_t now);
+static uint16_t elapsed_now(void);
+
+// Timer ticks in a second
+#define SECOND_TICKS ((uint32_t)CLOCK_A * CLOCK_B)
+
+// Length of a compare match A period in the trim units (0.01 µs)
+#define TRIM_PERIOD (100000000L / CLOCK_B)
+
+// The trim may lengthen a second by one period.
+#if CLOCK_B > 254
+#error CLOCK_B must be less than 255
+#endif
 
 static volatile uint8_t counter_b = CLOCK_B;
+static volatile uint8_t second_len = CLOCK_B; // Periods in this second
+static volatile int16_t trim = 0; // Crystal trim, see config.h
+static int32_t drift = 0;         // Accumulated trim, used only in ISR
 static bool is_set = false;
 
 // DST changes data (avr = AVR epoch, not UNIX)
 static time_t clock_turn_avr;
-static int32_t clock_turn_offset;
-
-// These variables are stored in EEPROM. Zone variables are signed
-// despite of the data type. Parameters zone_now and zone_turn are in
-// "gmtoff" format, i.e. seconds east to UTC, e.g. 3600 for
-// UTC+1. Parameter zone_now is the currently observed gmtoffime
-// zone. Parameter ts_turn defines when the clocks turn the next
-// time. Parameter zone_turn is the gmtoff observed after that
-// moment. In case of no known future DST changes, ts_turn must be 0.
-// These are uints for compatibility. In practice zone variables are
-// signed, but that's taken care in update_tzdata_from_eeprom().
-static uint32_t ee_zone_now EEMEM = 0;
-static uint32_t ee_ts_turn EEMEM = 0;
-static uint32_t ee_zone_turn EEMEM = 0;
+static int32_t zone_before;
+static int32_t zone_after;
+
+// Table of future UTC offset changes
+typedef struct {
+	uint32_t ts;     // UNIX timestamp, 0 if unused
+	int16_t gmtoff;  // UTC offset after ts, in minutes
+} dst_entry_t;
+
+static dst_entry_t ee_dst_table[CLOCK_DST_LEN] EEMEM;
+static dst_entry_t dst_table[CLOCK_DST_LEN]; // SRAM copy of ee_dst_table
+static uint8_t dst_len = 0;                  // Entries in use
+
+static int8_t dst_table_len(dst_entry_t const *table);
+
+// Timers. Accessed only inside ISRs and atomic blocks.
+static uint32_t ticks = 0;               // Ticks at the start of the period
+static clock_timer_t *timers = NULL;     // Sorted by deadline
+static clock_timer_handler_t priority_f; // Priority timer handler
+static uint32_t priority_deadline;
+static bool priority_armed = false;
+
 
 void clock_init(void)
 {
@@ -75,8 +109,17 @@ void clock_init(void)
 #error Prescaler must be one of: 1, 8, 32, 64, 128, 256, 1024.
 #endif
 
-	// Read current timezone data from EEPROM
-	update_tzdata_from_eeprom();
+	// Load DST table. Erased or corrupt table is ignored.
+	eeprom_read_block(dst_table, ee_dst_table, sizeof(dst_table));
+	int8_t const len = dst_table_len(dst_table);
+	if (len < 0) {
+		memset(dst_table, 0, sizeof(dst_table));
+	} else {
+		dst_len = len;
+	}
+
+	// Apply current timezone data from the configuration
+	clock_reconfigure();
 
 	// Use our own function for summer time math
 	set_dst(unixy_dst);
@@ -92,68 +135,148 @@ modbus_status_t clock_set_time_unix(time_t const ts_now)
 		// Reset counters. Not resetting TIMER2 because it
 		// would interfers with UART delay timers.
 		counter_b = CLOCK_B;
+		second_len = CLOCK_B;
 		set_system_time(avr_now);
 		is_set = true;
 	}
 	return MODBUS_OK;
 }
 
-bool clock_is_set(void)
+void clock_get_exact(uint16_t *const out)
 {
-	return is_set;
+	time_t avr_now;
+	uint32_t elapsed, len;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		avr_now = time(NULL);
+		elapsed = elapsed_now();
+		len = (uint16_t)second_len * CLOCK_A;
+		if (elapsed >= len) {
+			// The second has ended but the interrupt is
+			// still pending.
+			avr_now++;
+			elapsed -= len;
+		}
+	}
+	uint32_t const ts = avr_now + UNIX_OFFSET;
+	out[0] = ts >> 16;
+	out[1] = ts;
+	out[2] = elapsed * CLOCK_FRAC_SCALE / len;
 }
 
-// Reads time zone data from EEPROM and apply it to the system. See
-// ee_* definitions above for how to set the data.
-static void update_tzdata_from_eeprom(void)
+modbus_status_t clock_set_exact(uint16_t const *const in)
 {
-	// Collect data from persistent memory
-	int32_t const zone_now = eeprom_read_dword(&ee_zone_now);
-	time_t const ts_turn = eeprom_read_dword(&ee_ts_turn);
-	int32_t const zone_turn = eeprom_read_dword(&ee_zone_turn);
+	time_t const avr_now = ((uint32_t)in[0] << 16 | in[1]) - UNIX_OFFSET;
+	uint32_t const elapsed = in[2] * SECOND_TICKS / CLOCK_FRAC_SCALE;
 
-	// DST structure in UNIX and AVR-libc are different. Unix uses
-	// time zone offset directly but avr-libc thinks traditionally
-	// by using "base zone" and supports positive DST offsets
-	// only. Therefore we need to mangle the data a bit.
+	// Writing CLOCK_A-1 would block the compare match and the
+	// counter would run to 255. Losing one tick is fine.
+	uint8_t tcnt = elapsed % CLOCK_A;
+	if (tcnt > CLOCK_A-2) tcnt = CLOCK_A-2;
 
-	// Current zone is smaller of the two, because DST offset must
-	// be positive. When no DST, use zone_now.
-	int32_t const pseudo_zone = ts_turn == 0 || zone_now < zone_turn ? zone_now : zone_turn;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		// Keep the monotonic time continuous by moving the
+		// period start as much as the counter jumps. A pending
+		// compare match is accounted in ticks_now() and cleared
+		// because counter_b is overwritten anyway.
+		uint32_t const now = ticks_now();
+		TIFR2 = _BV(OCF2A);
+		TCNT2 = tcnt;
+		ticks = now - tcnt;
+
+		counter_b = CLOCK_B - elapsed / CLOCK_A;
+		second_len = CLOCK_B;
+		set_system_time(avr_now);
+		is_set = true;
 
-	// Calculate difference of current and future zones. In case
-	// of no DST (ts_turn is 0) make sure the offset is zero, too.
-	int32_t const new_turn_offset = ts_turn == 0 ? 0 : zone_turn - zone_now;
+		// Compare match B is relative to the counter
+		reprogram(now);
+	}
+	return MODBUS_OK;
+}
+
+bool clock_is_set(void)
+{
+	return is_set;
+}
+
+void clock_reconfigure(void)
+{
+	uint32_t const ts_turn = config.ts_turn;
+
+	// In case of no DST (ts_turn is 0) the zone never changes.
+	zone_before = config.zone_now;
+	zone_after = ts_turn == 0 ? config.zone_now : config.zone_turn;
 
 	// AVR uses Zigbee epoch. Converting from UNIX epoch
-	time_t const new_turn_avr = ts_turn - UNIX_OFFSET;
+	clock_turn_avr = ts_turn - UNIX_OFFSET;
+
+	set_base_zone();
 
-	// Make sure we do the clock update stuff atomically
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-		set_zone(pseudo_zone);
-		clock_turn_avr = new_turn_avr;
-		clock_turn_offset = new_turn_offset;
+		trim = config.trim;
+	}
+}
+
+void clock_get_dst_table(uint16_t *out)
+{
+	for (uint8_t i = 0; i < CLOCK_DST_LEN; i++) {
+		*out++ = dst_table[i].ts >> 16;
+		*out++ = dst_table[i].ts;
+		*out++ = dst_table[i].gmtoff;
+	}
+}
+
+modbus_status_t clock_set_dst_table(uint16_t const *in)
+{
+	dst_entry_t table[CLOCK_DST_LEN];
+	for (uint8_t i = 0; i < CLOCK_DST_LEN; i++) {
+		table[i].ts = (uint32_t)in[0] << 16 | in[1];
+		table[i].gmtoff = in[2];
+		in += 3;
+	}
+
+	int8_t const len = dst_table_len(table);
+	if (len < 0) {
+		return MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE;
 	}
+
+	memcpy(dst_table, table, sizeof(dst_table));
+	dst_len = len;
+	persist_update(ee_dst_table, dst_table, sizeof(dst_table));
+	set_base_zone();
+	return MODBUS_OK;
+}
+
+modbus_status_t clock_set_trim(int16_t ppm)
+{
+	config.trim = ppm;
+	config_commit();
+	return MODBUS_OK;
+}
+
+int16_t clock_get_trim(void)
+{
+	return config.trim;
 }
 
 modbus_status_t clock_set_gmtoff(int32_t gmtoff)
 {
-	eeprom_update_dword(&ee_zone_now, gmtoff);
-	update_tzdata_from_eeprom();
+	config.zone_now = gmtoff;
+	config_commit();
 	return MODBUS_OK;
 }
 
 modbus_status_t clock_set_next_turn(uint32_t ts)
 {
-	eeprom_update_dword(&ee_ts_turn, ts);
-	update_tzdata_from_eeprom();
+	config.ts_turn = ts;
+	config_commit();
 	return MODBUS_OK;
 }
 
 modbus_status_t clock_set_gmtoff_turn(int32_t gmtoff)
 {
-	eeprom_update_dword(&ee_zone_turn, gmtoff);
-	update_tzdata_from_eeprom();
+	config.zone_turn = gmtoff;
+	config_commit();
 	return MODBUS_OK;
 }
 
@@ -166,21 +289,131 @@ int32_t clock_get_gmtoff()
 {
 	time_t now;
 	time(&now);
-	return __utc_offset + unixy_dst(&now, NULL);
+	return gmtoff_at(&now);
 }
 
 uint32_t clock_get_next_turn()
 {
-	return eeprom_read_dword(&ee_ts_turn);
+	return config.ts_turn;
 }
 
 int32_t clock_get_gmtoff_turn()
 {
-	return eeprom_read_dword(&ee_zone_turn);
+	return config.zone_turn;
+}
+
+void clock_set_timer_handler(clock_timer_handler_t f)
+{
+	priority_f = f;
 }
 
 void clock_arm_timer(uint8_t delay)
 {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		uint32_t const now = ticks_now();
+		priority_deadline = now + delay;
+		priority_armed = true;
+		reprogram(now);
+	}
+}
+
+void clock_timer_start(clock_timer_t *t, uint32_t delay, uint32_t period)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		uint32_t const now = ticks_now();
+		unlink(t);
+		t->deadline = now + delay;
+		t->period = period;
+		insert(t);
+		reprogram(now);
+	}
+}
+
+uint32_t clock_get_ticks(void)
+{
+	uint32_t now;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		now = ticks_now();
+	}
+	return now;
+}
+
+// Get current time in ticks. Call with interrupts disabled.
+static uint32_t ticks_now(void)
+{
+	uint8_t const tcnt = TCNT2;
+	// If the counter has wrapped but the compare A interrupt is
+	// still pending, the period has not been added yet.
+	if ((TIFR2 & _BV(OCF2A)) && tcnt < CLOCK_A-1) {
+		return ticks + CLOCK_A + tcnt;
+	}
+	return ticks + tcnt;
+}
+
+// Get ticks elapsed in the current second. May be a full second if
+// the second has ended but the interrupt hasn't run yet. Call with
+// interrupts disabled.
+static uint16_t elapsed_now(void)
+{
+	uint8_t const tcnt = TCNT2;
+	uint16_t elapsed = (uint16_t)(second_len - counter_b) * CLOCK_A + tcnt;
+	if ((TIFR2 & _BV(OCF2A)) && tcnt < CLOCK_A-1) {
+		elapsed += CLOCK_A;
+	}
+	return elapsed;
+}
+
+static bool is_due(uint32_t deadline, uint32_t now)
+{
+	return (int32_t)(deadline - now) <= 0;
+}
+
+// Insert timer to the list, keeping it sorted by the deadline.
+static void insert(clock_timer_t *t)
+{
+	clock_timer_t **p = &timers;
+	while (*p != NULL && is_due((*p)->deadline, t->deadline)) {
+		p = &(*p)->next;
+	}
+	t->next = *p;
+	*p = t;
+}
+
+// Remove timer from the list, if it's there.
+static void unlink(clock_timer_t *t)
+{
+	for (clock_timer_t **p = &timers; *p != NULL; p = &(*p)->next) {
+		if (*p == t) {
+			*p = t->next;
+			return;
+		}
+	}
+}
+
+// Set compare match B to the nearest deadline. Deadlines beyond the
+// current timer period are programmed by compare match A interrupt
+// when their period comes.
+static void reprogram(uint32_t now)
+{
+	bool armed = false;
+	uint32_t deadline;
+	if (priority_armed) {
+		deadline = priority_deadline;
+		armed = true;
+	}
+	if (timers != NULL && (!armed || is_due(timers->deadline, deadline))) {
+		deadline = timers->deadline;
+		armed = true;
+	}
+
+	// The earliest match is on the next tick
+	int32_t delay = armed ? (int32_t)(deadline - now) : CLOCK_A;
+	if (delay < 1) delay = 1;
+	if (delay >= CLOCK_A) {
+		TIMSK2 &= ~_BV(OCIE2B);
+		return;
+	}
+
 	// To avoid difficult to handle integer overflows, we are
 	// using 16 bit integer for the math and then do integer
 	// modulo operation.
@@ -190,32 +423,135 @@ void clock_arm_timer(uint8_t delay)
 	// Set timer B match to given target.
 	OCR2B = target;
 
-	// Clear interrupt flag
-	TIFR2 |= _BV(OCF2B);
+	// Clear interrupt flag. Writing one clears the flag, so a
+	// read-modify-write would clear a pending OCF2A, too.
+	TIFR2 = _BV(OCF2B);
 	
 	// Enable Timer Compare match B interrupt.
 	TIMSK2 |= _BV(OCIE2B);
 }
 
 // Timer interrupt increments counter_b until full second is elapsed.
-ISR(TIMER2_COMPA_vect)
+STATS_ISR(TIMER2_COMPA_vect, STATS_TIMER_A)
 {
+	sram_isr_leaf();
+
+	ticks += CLOCK_A;
+
+	// Program deadlines which fall into this period
+	if (!(TIMSK2 & _BV(OCIE2B)) && (priority_armed || timers != NULL)) {
+		reprogram(ticks_now());
+	}
+
 	counter_b--;
 	if (counter_b == 0) {
 		system_tick();
-		counter_b = CLOCK_B;
+
+		// Crystal drift compensation. The error is accumulated
+		// every second and when it's a full period, the next
+		// second is made one period longer or shorter.
+		drift += trim;
+		second_len = CLOCK_B;
+		if (drift >= TRIM_PERIOD) {
+			drift -= TRIM_PERIOD;
+			second_len++;
+		} else if (drift <= -TRIM_PERIOD) {
+			drift += TRIM_PERIOD;
+			second_len--;
+		}
+		counter_b = second_len;
+	}
+}
+
+// Runs expired timers, the priority timer first.
+STATS_ISR(TIMER2_COMPB_vect, STATS_TIMER_B)
+{
+	sram_isr_leaf();
+
+	uint32_t const now = ticks_now();
+
+	if (priority_armed && is_due(priority_deadline, now)) {
+		priority_armed = false;
+		priority_f();
+	}
+
+	while (timers != NULL && is_due(timers->deadline, now)) {
+		clock_timer_t *const t = timers;
+		timers = t->next;
+		if (t->period != 0) {
+			t->deadline += t->period;
+			insert(t);
+		}
+		t->f();
 	}
+
+	reprogram(now);
 }
 
-// This DST handler can only handle present and future DST changes
-// over one DST change. Meaning it doesn't work as expected for past
-// dates and if the time is more than couple of months in
-// advance. With usual control tasks it's not a problem.
+// DST structure in UNIX and AVR-libc are different. Unix uses time
+// zone offset directly but avr-libc thinks traditionally by using
+// "base zone" and supports positive DST offsets only. Therefore the
+// base zone is the smallest of the offsets and the DST handler returns
+// the difference to it.
 static int unixy_dst(const time_t *time, int32_t *z)
 {
-	bool const before_turn = *time < clock_turn_avr;
-	bool const towards_summer = clock_turn_offset > 0;
-	bool const is_now_dst = before_turn ^ towards_summer;
+	return gmtoff_at(time) - __utc_offset;
+}
+
+// Get the UTC offset at the given time. The DST table is used after
+// its first entry, before that the single change in the
+// configuration. Past dates before the configured change get the
+// current offset.
+static int32_t gmtoff_at(time_t const *time)
+{
+	uint32_t const ts = *time + UNIX_OFFSET;
 
-	return is_now_dst ? labs(clock_turn_offset) : 0;
+	if (dst_len == 0 || ts < dst_table[0].ts) {
+		return *time < clock_turn_avr ? zone_before : zone_after;
+	}
+
+	// Binary search for the last entry at or before ts
+	uint8_t low = 0, high = dst_len;
+	while (low + 1 < high) {
+		uint8_t const mid = (low + high) / 2;
+		if (ts < dst_table[mid].ts) {
+			high = mid;
+		} else {
+			low = mid;
+		}
+	}
+	return dst_table[low].gmtoff * 60l;
+}
+
+// Get the number of used entries in a DST table. Used entries must be
+// ascending and followed only by unused entries. Returns -1 if the
+// table is invalid.
+static int8_t dst_table_len(dst_entry_t const *table)
+{
+	uint8_t len = 0;
+	while (len < CLOCK_DST_LEN && table[len].ts != 0) {
+		if (len > 0 && table[len].ts <= table[len-1].ts) return -1;
+		// Real offsets are within a day
+		int16_t const gmtoff = table[len].gmtoff;
+		if (gmtoff <= -24*60 || gmtoff >= 24*60) return -1;
+		len++;
+	}
+	for (uint8_t i = len; i < CLOCK_DST_LEN; i++) {
+		if (table[i].ts != 0) return -1;
+	}
+	return len;
+}
+
+// Set avr-libc base zone to the smallest of all offsets.
+static void set_base_zone(void)
+{
+	int32_t zone = zone_before < zone_after ? zone_before : zone_after;
+	for (uint8_t i = 0; i < dst_len; i++) {
+		int32_t const gmtoff = dst_table[i].gmtoff * 60l;
+		if (gmtoff < zone) zone = gmtoff;
+	}
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		set_zone(zone);
+	}
 }
@@ -19,12 +19,26 @@
   Counter2 compare match A is used for the real-time clock, so
   compare match B interrupt is available for accuracy timing, having
   granularity of prescaler / F_CPU = 16µs.
+
+  Compare match B is shared by software timers. The priority timer
+  is meant for the serial line framing, and it can be re-armed in
+  constant time on every received byte. Other timers, like the once
+  per second timer of the main loop, are kept in a list sorted by the
+  deadline. Timer handlers are called from the
+  interrupt with interrupts disabled, so they must be short. Longer
+  work can be deferred with task_post().
 */
 
 #include <time.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "modbus_types.h"
 
+// Number of entries in the DST table. Each takes 3 registers and the
+// whole table must fit in a single Modbus write. Keep in sync with the
+// array length in commands.tsv.
+#define CLOCK_DST_LEN 10
+
 // Initialize clock using TIMER2
 void clock_init(void);
 
@@ -32,9 +46,31 @@ void clock_init(void);
 // counters. Timestamp epoch is UNIX.
 modbus_status_t clock_set_time_unix(time_t const ts_now);
 
+// Number of fraction units in a second.
+#define CLOCK_FRAC_SCALE 65536UL
+
+// Reads the time with sub-second precision to out[0..2]: UNIX
+// timestamp as two big-endian words followed by the fraction of the
+// second in 1/65536 s units. All are read atomically.
+void clock_get_exact(uint16_t *out);
+
+// Sets the time with sub-second precision. Same format as in
+// clock_get_exact(). Running software timers are not affected.
+modbus_status_t clock_set_exact(uint16_t const *in);
+
 // Test if clock is already set or is it running fake time
 bool clock_is_set(void);
 
+// Applies time zone data from the configuration to the system.
+void clock_reconfigure(void);
+
+// Sets crystal trim in 0.01 ppm units. Positive values slow the clock
+// down, to compensate a crystal running too fast.
+modbus_status_t clock_set_trim(int16_t trim);
+
+// Gets crystal trim in 0.01 ppm units.
+int16_t clock_get_trim(void);
+
 // Sets current gmtoff (time zone in seconds east to Greenwich).
 modbus_status_t clock_set_gmtoff(int32_t gmtoff);
 
@@ -44,6 +80,16 @@ modbus_status_t clock_set_next_turn(uint32_t ts);
 // Sets gmtoff after next clock turn.
 modbus_status_t clock_set_gmtoff_turn(int32_t gmtoff);
 
+// Reads the DST table to out. See clock_set_dst_table().
+void clock_get_dst_table(uint16_t *out);
+
+// Sets the table of future UTC offset changes. Each entry has a UNIX
+// timestamp in two words followed by the UTC offset after it in
+// minutes. The timestamps must be ascending. Unused entries at the end
+// have timestamp 0. The table is stored to EEPROM. The table overrides
+// the single change in the configuration after its first entry.
+modbus_status_t clock_set_dst_table(uint16_t const *in);
+
 // Reads current time as UNIX timestamp
 time_t clock_get_time_unix(void);
 
@@ -58,7 +104,33 @@ uint32_t clock_get_next_turn(void);
 // Read next clock turn timestamp
 int32_t clock_get_gmtoff_turn();
 
-// Arm timer for interrupt TIMER2_COMPB_vect. Timeout unit is
-// prescaler / F_CPU = 16µs and maximum delay of prescaler * COUNT_A /
-// F_CPU = 4ms.
+// Converts milliseconds to timer ticks.
+#define CLOCK_MS(ms) ((uint32_t)(ms) * (F_CPU / CLOCK_PRESCALER) / 1000)
+
+// Function called when a timer expires.
+typedef void (*clock_timer_handler_t)(void);
+
+// Software timer. Allocate statically and don't touch the fields
+// other than f.
+typedef struct clock_timer {
+	struct clock_timer *next; // Next timer in the list
+	uint32_t deadline;        // Expiry time in ticks
+	uint32_t period;          // Period in ticks, 0 if one-shot
+	clock_timer_handler_t f;  // Handler
+} clock_timer_t;
+
+// Set handler of the priority timer.
+void clock_set_timer_handler(clock_timer_handler_t f);
+
+// Arm the priority timer. Timeout unit is prescaler / F_CPU = 16µs.
+// Re-arming replaces the previous timeout.
 void clock_arm_timer(uint8_t timeout);
+
+// Start software timer t to expire after delay ticks and then every
+// period ticks. Period of 0 makes it a one-shot timer. Restarts the
+// timer if it's already running.
+void clock_timer_start(clock_timer_t *t, uint32_t delay, uint32_t period);
+
+// Get the monotonic time in ticks. Wraps around in 19 hours, so
+// compare only differences.
+uint32_t clock_get_ticks(void);
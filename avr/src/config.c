@@ -0,0 +1,160 @@
+// Pumpunjuksautin device configuration.
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+#include "config.h"
+#include "store.h"
+#include "clock.h"
+#include "juksautin.h"
+
+// Mapping of a config field to a store key
+typedef struct {
+	uint8_t offset;
+	uint8_t size;
+	store_key_t key;
+} field_t;
+
+#define FIELD(name, key) { offsetof(config_t, name), sizeof(((config_t*)0)->name), key }
+
+static field_t const fields[] PROGMEM = {
+	FIELD(target[0], STORE_TARGET),
+#ifdef LINE_K9_ADC
+	FIELD(target[1], STORE_TARGET_K9),
+#endif
+	FIELD(zone_now, STORE_ZONE_NOW),
+	FIELD(ts_turn, STORE_TS_TURN),
+	FIELD(zone_turn, STORE_ZONE_TURN),
+	FIELD(trim, STORE_TRIM),
+};
+
+#define FIELDS (sizeof(fields) / sizeof(*fields))
+
+static config_t const defaults PROGMEM = {
+	.target = { [0 ... JUKSAUTIN_LINES-1] = 1000l * 256 / 275 }, // 1 V, see MV_MULT in juksautin.c
+};
+
+static void save(void);
+static void apply(void);
+static uint16_t header(void);
+
+config_t config;
+
+static config_t backup;           // Configuration before the transaction
+static uint8_t depth = 0;         // Transaction nesting level
+static bool dirty = false;        // Changed during the transaction
+static bool failed = false;       // Has a nested transaction failed?
+
+void config_init(void)
+{
+	memcpy_P(&config, &defaults, sizeof(config));
+
+	// Header contains version and CRC. If there's none, it's a
+	// fresh device and the fields are not found either.
+	uint32_t stored = 0;
+	bool const found = store_get(STORE_CONFIG_HEADER, &stored);
+	if (found && stored >> 8 != CONFIG_VERSION) {
+		// Incompatible, start over.
+		save();
+		return;
+	}
+
+	for (uint8_t i = 0; i < FIELDS; i++) {
+		field_t f;
+		memcpy_P(&f, fields + i, sizeof(f));
+		uint32_t value;
+		if (store_get(f.key, &value)) {
+			memcpy((uint8_t*)&config + f.offset, &value, f.size);
+		}
+	}
+
+	// If the previous commit was interrupted, make the stored
+	// copy consistent again.
+	if (found && stored != header()) save();
+}
+
+void config_commit(void)
+{
+	if (depth) {
+		dirty = true;
+	} else {
+		save();
+		apply();
+	}
+}
+
+void config_begin(void)
+{
+	if (depth++) return;
+	backup = config;
+	dirty = false;
+	failed = false;
+}
+
+void config_end(bool const ok)
+{
+	if (!ok) failed = true;
+	if (--depth) return;
+	if (!dirty) return;
+	dirty = false;
+
+	if (failed) {
+		// Nothing has been applied during the transaction
+		config = backup;
+		juksautin_forget_writes();
+		return;
+	}
+	save();
+	apply();
+}
+
+// Write changed fields to the store.
+static void save(void)
+{
+	for (uint8_t i = 0; i < FIELDS; i++) {
+		field_t f;
+		memcpy_P(&f, fields + i, sizeof(f));
+		uint32_t value = 0;
+		memcpy(&value, (uint8_t*)&config + f.offset, f.size);
+		store_set(f.key, value);
+	}
+
+	// Header is written last to detect interrupted commits.
+	store_set(STORE_CONFIG_HEADER, header());
+}
+
+// Let the modules know about the changes.
+static void apply(void)
+{
+	clock_reconfigure();
+	juksautin_reconfigure();
+}
+
+// Get the header containing version and CRC-8 of the current
+// configuration.
+static uint16_t header(void)
+{
+	uint8_t const *p = (uint8_t const *)&config;
+	uint8_t crc = 0xFF;
+	for (uint8_t i = 0; i < sizeof(config); i++) {
+		crc = _crc8_ccitt_update(crc, p[i]);
+	}
+	return CONFIG_VERSION << 8 | crc;
+}
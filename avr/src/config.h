@@ -0,0 +1,67 @@
+#pragma once
+
+/*
+  Device configuration
+
+  All persistent settings live in a single struct in SRAM. It's
+  loaded from the store once at boot and read directly afterwards.
+  Changes are made to the struct and written out explicitly with
+  config_commit(). Only the changed fields are written. After that
+  the modules are asked to apply the new configuration.
+
+  Command interfaces wrap each incoming frame in a transaction. Inside
+  a transaction, config_commit() is deferred to config_end() so the
+  configuration is saved and applied only once per frame, and rolled
+  back altogether if the frame fails.
+
+  The struct has a version number and a CRC which are stored after
+  the fields. If the stored version doesn't match CONFIG_VERSION the
+  stored values are ignored and the defaults are used instead.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hardware_config.h"
+
+// Increment when the meaning of the fields changes.
+#define CONFIG_VERSION 1
+
+typedef struct {
+	// Target voltage of each juksautus line in raw ADC units
+	uint16_t target[JUKSAUTIN_LINES];
+
+	// Time zone. Parameters zone_now and zone_turn are in
+	// "gmtoff" format, i.e. seconds east to UTC, e.g. 3600 for
+	// UTC+1. Parameter zone_now is the currently observed
+	// gmtoff. Parameter ts_turn defines when the clocks turn the
+	// next time as UNIX timestamp. Parameter zone_turn is the
+	// gmtoff observed after that moment. In case of no known
+	// future DST changes, ts_turn must be 0.
+	int32_t zone_now;
+	uint32_t ts_turn;
+	int32_t zone_turn;
+
+	// Crystal trim in 0.01 ppm units. Positive if the crystal runs
+	// too fast.
+	int16_t trim;
+} config_t;
+
+// The configuration. Modify and call config_commit() to persist.
+extern config_t config;
+
+// Load configuration from the store. Call after store_init().
+void config_init(void);
+
+// Write changed fields to the store and apply them, or if inside a
+// transaction, mark the configuration to be committed at the end.
+void config_commit(void);
+
+// Start a transaction. Transactions may nest, e.g. the ASCII
+// interface tunnelled inside Modbus. Only the outermost one commits.
+void config_begin(void);
+
+// End a transaction. If ok, commit the changes done during the
+// transaction. Otherwise restore the configuration to the state it
+// had when the transaction began. If a nested transaction fails, the
+// outermost one is rolled back too.
+void config_end(bool ok);
@@ -6,3 +6,20 @@
 #define PIN_TX_EN D,2
 #define PIN_LED D,3
 //#define PIN_LED B,5 // Arduino pin 13
+
+// Juksautus lines: the ADC input of the thermistor line and the pin
+// which pulls it down. The K9 line is not on hardware version 0.9 and
+// is enabled with the WITH_K9 build option. The register banks in
+// commands.tsv are generated for the same number of lines.
+#define LINE_K5_ADC 0
+#define LINE_K5_PIN PIN_FB
+#if WITH_K9
+#define LINE_K9_ADC 5
+#define LINE_K9_PIN D,4
+#endif
+
+#ifdef LINE_K9_ADC
+#define JUKSAUTIN_LINES 2
+#else
+#define JUKSAUTIN_LINES 1
+#endif
@@ -0,0 +1,240 @@
+// Pumpunjuksautin measurement history recorder.
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <avr/io.h>
+#include "history.h"
+#include "juksautin.h"
+#include "clock.h"
+#include "byteswap.h"
+
+#define FIELDS JUKSAUTIN_SAMPLE_LEN
+#define TIME_BIT _BV(6)
+
+// Longest possible record: header, time and 16-bit differences.
+#define RECORD_MAX (1 + 4 + FIELDS * 2)
+
+#if HISTORY_LEN < RECORD_MAX || HISTORY_LEN > 0x7fff
+#error HISTORY_LEN is out of range
+#endif
+
+#if HISTORY_INTERVAL < 1 || HISTORY_INTERVAL > 255
+#error HISTORY_INTERVAL must be between 1 and 255 seconds
+#endif
+
+// A fully decoded sample
+typedef struct {
+	uint16_t seq;
+	uint32_t time;
+	uint16_t value[FIELDS];
+} sample_t;
+
+static uint8_t encode(uint8_t *out, sample_t const *prev, sample_t const *cur);
+static uint8_t record_len(uint16_t pos);
+static uint16_t decode(uint16_t pos, sample_t *s);
+static uint16_t ring_next(uint16_t pos);
+
+static uint8_t ring[HISTORY_LEN]; // Delta-encoded records
+static uint16_t tail = 0;         // Position of the oldest record
+static uint16_t used = 0;         // Bytes in use
+static uint16_t count = 0;        // Number of samples, including keyframe
+static sample_t oldest;           // Keyframe, the oldest sample
+static sample_t newest;           // The latest sample
+static uint8_t countdown = 1;     // Seconds until the next sample
+
+__attribute__((noinline, noclone))
+void history_tick(void)
+{
+	if (--countdown) return;
+	countdown = HISTORY_INTERVAL;
+
+	sample_t cur;
+	cur.seq = newest.seq + 1;
+	cur.time = clock_get_time_unix();
+	juksautin_take_sample(cur.value);
+
+	if (count == 0) {
+		// The very first sample is the keyframe.
+		oldest = cur;
+		newest = cur;
+		count = 1;
+		return;
+	}
+
+	uint8_t rec[RECORD_MAX];
+	uint8_t const len = encode(rec, &newest, &cur);
+
+	// Make space by rolling the keyframe forward.
+	while (HISTORY_LEN - used < len) {
+		uint8_t const old_len = record_len(tail);
+		tail = decode(tail, &oldest);
+		used -= old_len;
+		count--;
+	}
+
+	// Write to the head of the ring.
+	uint16_t pos = tail + used;
+	if (pos >= HISTORY_LEN) pos -= HISTORY_LEN;
+	for (uint8_t i = 0; i < len; i++) {
+		ring[pos] = rec[i];
+		pos = ring_next(pos);
+	}
+	used += len;
+	count++;
+	newest = cur;
+}
+
+uint16_t history_get_oldest(void)
+{
+	return oldest.seq;
+}
+
+uint16_t history_get_count(void)
+{
+	return count;
+}
+
+uint16_t history_get_interval(void)
+{
+	return HISTORY_INTERVAL;
+}
+
+buflen_t history_read(uint16_t seq, char *buf, buflen_t buf_len)
+{
+	// Nothing new, or nothing at all.
+	if (count == 0 || seq == (uint16_t)(newest.seq + 1)) return 0;
+
+	if (buf_len < HISTORY_KEYFRAME_LEN) return 0;
+
+	// Start from the oldest if we don't have the requested one.
+	uint16_t skip = seq - oldest.seq;
+	if (skip >= count) skip = 0;
+
+	// Walk to the requested sample.
+	sample_t s = oldest;
+	uint16_t pos = tail;
+	while (skip--) {
+		pos = decode(pos, &s);
+	}
+
+	// Keyframe
+	uint16_t *word = (uint16_t*)buf;
+	*word++ = bswap_16(s.seq);
+	*word++ = bswap_16(s.time >> 16);
+	*word++ = bswap_16(s.time);
+	for (uint8_t i = 0; i < FIELDS; i++) {
+		*word++ = bswap_16(s.value[i]);
+	}
+	buflen_t out = HISTORY_KEYFRAME_LEN;
+
+	// Copy whole records which fit.
+	uint16_t end = tail + used;
+	if (end >= HISTORY_LEN) end -= HISTORY_LEN;
+	while (pos != end) {
+		uint8_t const len = record_len(pos);
+		if (out + len > buf_len - (buf_len & 1)) break;
+		for (uint8_t i = 0; i < len; i++) {
+			buf[out++] = ring[pos];
+			pos = ring_next(pos);
+		}
+	}
+
+	// Registers are 16 bits wide.
+	if (out & 1) {
+		buf[out++] = HISTORY_PAD;
+	}
+	return out;
+}
+
+// Encodes the difference between samples prev and cur to out. Returns
+// record length.
+static uint8_t encode(uint8_t *out, sample_t const *prev, sample_t const *cur)
+{
+	uint8_t *p = out + 1;
+	uint8_t header = 0;
+
+	int32_t const dt = cur->time - prev->time;
+	if (dt != HISTORY_INTERVAL) {
+		// Clock was set or the sample was late.
+		header |= TIME_BIT;
+		*p++ = dt >> 24;
+		*p++ = dt >> 16;
+		*p++ = dt >> 8;
+		*p++ = dt;
+	}
+
+	for (uint8_t i = 0; i < FIELDS; i++) {
+		int16_t const d = cur->value[i] - prev->value[i];
+		if (d < INT8_MIN || d > INT8_MAX) {
+			header |= _BV(i);
+			*p++ = d >> 8;
+		}
+		*p++ = d;
+	}
+
+	*out = header;
+	return p - out;
+}
+
+// Gets the length of the record at the given ring position.
+static uint8_t record_len(uint16_t pos)
+{
+	uint8_t const header = ring[pos];
+	uint8_t len = 1 + FIELDS;
+	if (header & TIME_BIT) len += sizeof(int32_t);
+	for (uint8_t i = 0; i < FIELDS; i++) {
+		if (header & _BV(i)) len++;
+	}
+	return len;
+}
+
+// Applies the record at the given ring position to sample s. Returns
+// the position of the next record.
+static uint16_t decode(uint16_t pos, sample_t *s)
+{
+	uint8_t const header = ring[pos];
+	pos = ring_next(pos);
+
+	if (header & TIME_BIT) {
+		uint32_t dt = 0;
+		for (uint8_t i = 0; i < sizeof(dt); i++) {
+			dt = dt << 8 | ring[pos];
+			pos = ring_next(pos);
+		}
+		s->time += dt;
+	} else {
+		s->time += HISTORY_INTERVAL;
+	}
+
+	for (uint8_t i = 0; i < FIELDS; i++) {
+		int16_t d = (int8_t)ring[pos];
+		if (header & _BV(i)) {
+			pos = ring_next(pos);
+			d = (uint16_t)d << 8 | ring[pos];
+		}
+		pos = ring_next(pos);
+		s->value[i] += d;
+	}
+
+	s->seq++;
+	return pos;
+}
+
+// Advance ring position by one.
+static uint16_t ring_next(uint16_t pos)
+{
+	return ++pos == HISTORY_LEN ? 0 : pos;
+}
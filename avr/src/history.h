@@ -0,0 +1,54 @@
+#pragma once
+
+/*
+  Time-series history of the measurements
+
+  Every HISTORY_INTERVAL seconds a sample of all the values returned
+  by juksautin_take_sample() is recorded with a timestamp. Samples
+  are stored delta-encoded to a ring buffer of HISTORY_LEN bytes and
+  the oldest ones are thrown away when the buffer fills up.
+
+  Samples have 16-bit sequence numbers, wrapping around. The oldest
+  sample is stored in full ("keyframe") and every following sample is
+  a record containing the differences to its predecessor:
+
+    header    1 byte   Bits 0-5: Value n difference is int16 instead
+                       of int8. Bit 6: Time difference is stored as
+                       int32. Otherwise it equals HISTORY_INTERVAL.
+                       Bit 7 is always 0.
+    time      0 or 4   Time difference in seconds, big-endian.
+    values    6-12     Value differences in the order of the sample,
+                       big-endian.
+*/
+
+#include <stdint.h>
+#include "serial.h"
+
+// Number of bytes in the keyframe produced by history_read().
+#define HISTORY_KEYFRAME_LEN 18
+
+// Byte value used for padding after the last record.
+#define HISTORY_PAD 0xFF
+
+// Call once per second. Records a new sample every HISTORY_INTERVAL
+// seconds.
+void history_tick(void);
+
+// Sequence number of the oldest stored sample.
+uint16_t history_get_oldest(void);
+
+// Number of stored samples.
+uint16_t history_get_count(void);
+
+// Sampling interval in seconds.
+uint16_t history_get_interval(void);
+
+// Fills the buffer with samples starting at the given sequence
+// number. The output starts with a keyframe (sequence number, UNIX
+// timestamp and the values, all big-endian) followed by as many whole
+// records as fit in buf_len bytes. The output is padded with
+// HISTORY_PAD to an even length. If seq is the sequence number of the
+// next sample to be recorded, nothing is written. If it's otherwise
+// outside of the stored range, the output starts from the oldest
+// sample. Returns the number of bytes written.
+buflen_t history_read(uint16_t seq, char *buf, buflen_t buf_len);
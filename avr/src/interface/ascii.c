@@ -22,6 +22,7 @@
 #include <avr/pgmspace.h>
 #include "ascii.h"
 #include "cmd.h"
+#include "../config.h"
 
 #define SERIAL_TX_END (serial_tx + SERIAL_TX_LEN)
 
@@ -29,6 +30,7 @@ static bool strip_line_ending(char *const buf, int const len);
 static cmd_result_t process_read(char const *name, char **out);
 static cmd_result_t process_write(char const *name, char *value);
 static bool process_help(void);
+static bool process_help_paged(char const *arg);
 static cmd_ascii_t const *find_cmd(char const *const name);
 static int cmd_comparator(const void *key_void, const void *item_void);
 static void location_aware_error(char const *const ref, cmd_result_t const *const e);
@@ -36,6 +38,9 @@ static void location_aware_error(char const *const ref, cmd_result_t const *cons
 // Version definition is delivered by version.cmake
 extern char const version[] PROGMEM;
 
+// Is the request tunnelled inside Modbus?
+static bool tunnel = false;
+
 // Replace line ending (LF or CRLF) from the message with NUL
 // character.
 static bool strip_line_ending(char *const buf, int const len)
@@ -185,6 +190,37 @@ static bool process_help()
 	return true;
 }
 
+// List registers compactly, as many as fit to the output, starting
+// from the index given in arg.
+static bool process_help_paged(char const *arg)
+{
+	int i = arg == NULL ? 0 : atoi(arg);
+	char *out = serial_tx;
+
+	// Leave space for the continuation mark
+	char *const end = SERIAL_TX_END - sizeof("+255");
+
+	for (; i < cmd_ascii_len; i++) {
+		char const *item_name = pgm_read_ptr_near(&cmd_ascii[i].name);
+		bool has_r = pgm_read_ptr_near(&cmd_ascii[i].printer) != NULL;
+		bool has_w = pgm_read_ptr_near(&cmd_ascii[i].scanner) != NULL;
+		int n = snprintf_P(out, end - out, PSTR("%S(%S%S) "), item_name,
+				   has_r ? PSTR("R") : PSTR(""),
+				   has_w ? PSTR("W") : PSTR(""));
+		if (n >= end - out) break;
+		out += n;
+	}
+
+	if (i < cmd_ascii_len) {
+		snprintf_P(out, SERIAL_TX_END - out, PSTR("+%d"), i);
+	} else if (out != serial_tx) {
+		*(out-1) = '\0';
+	} else {
+		*out = '\0';
+	}
+	return true;
+}
+
 // Search given command from the table generated to cmd.c
 static cmd_ascii_t const *find_cmd(char const *const name)
 {
@@ -206,6 +242,7 @@ static int cmd_comparator(const void *key_void, const void *item_void)
 
 // Entry point to this object. Processes given input in ASCII and
 // performs the operations in there.
+__attribute__((noinline, noclone))
 bool ascii_interface(char *buf, buflen_t len)
 {
 	char const *const buf_start = buf;
@@ -223,10 +260,18 @@ bool ascii_interface(char *buf, buflen_t len)
 		return false;
 	}
 
+	if (tunnel && strncasecmp_P(buf, PSTR("help"), 4) == 0 &&
+	    (buf[4] == '\0' || buf[4] == ' ')) {
+		return process_help_paged(buf[4] ? buf+5 : NULL);
+	}
+
 	if (strcasecmp_P(buf, PSTR("help")) == 0) {
 		return process_help();
 	}
 
+	// Configuration changes are committed once per line and only
+	// if all commands succeed.
+	config_begin();
 	do {
 		// Operation type parsing
 		char *value = strsep(&buf, " ");
@@ -242,9 +287,11 @@ bool ascii_interface(char *buf, buflen_t len)
 		if (res.error_msg != NULL) {
 			// We have to craft an error message
 			location_aware_error(buf_start, &res);
+			config_end(false);
 			return false;
 		}
 	} while (buf != NULL);
+	config_end(true);
 
 	if (out == serial_tx) {
 		// Filling OK if nothing else was written.
@@ -257,3 +304,11 @@ bool ascii_interface(char *buf, buflen_t len)
 
 	return true;
 }
+
+bool ascii_interface_tunnel(char *buf, buflen_t len)
+{
+	tunnel = true;
+	bool const ok = ascii_interface(buf, len);
+	tunnel = false;
+	return ok;
+}
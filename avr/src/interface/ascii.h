@@ -6,3 +6,9 @@
 
 // Process ASCII requests
 bool ascii_interface(char *buf, buflen_t len);
+
+// Process ASCII requests tunnelled inside Modbus frames. As
+// ascii_interface() but the help is paged to fit the output to a
+// single response. "help N" lists the registers starting from N and
+// ends with "+M" if there's more starting from M.
+bool ascii_interface_tunnel(char *buf, buflen_t len);
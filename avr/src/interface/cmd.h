@@ -61,6 +61,22 @@ typedef cmd_modbus_result_t cmd_bin_write_t(char const *const buf_in, buflen_t c
 #define cmd_bin_read_uint32 cmd_bin_read_int32
 #define cmd_bin_write_uint16 cmd_bin_write_int16
 #define cmd_bin_write_uint32 cmd_bin_write_int32
+#define cmd_bin_read_uint16_array cmd_bin_read_int16_array
+#define cmd_bin_write_uint16_array cmd_bin_write_int16_array
+
+// Block readers and writers. The generated code wraps them to
+// cmd_bin_read_t and cmd_bin_write_t with the block length given in
+// commands.tsv.
+
+// Reads a NUL padded string of len bytes. Getter is get_string_t.
+cmd_modbus_result_t cmd_bin_read_string(char *const buf_out, buflen_t count, void const *getter, buflen_t len);
+
+// Reads an array of len big endian 16 bit integers.
+cmd_modbus_result_t cmd_bin_read_int16_array(char *const buf_out, buflen_t count, void const *getter, uint8_t len);
+
+// Writes an array of len big endian 16 bit integers. The whole array
+// must be written at once.
+cmd_modbus_result_t cmd_bin_write_int16_array(char const *const buf_in, buflen_t count, void const *setter, uint8_t len);
 
 typedef struct {
 	void *read;           // NULL if not readable
@@ -94,6 +110,14 @@ typedef modbus_status_t set_int32_t(int32_t);
 typedef modbus_status_t set_uint16_t(uint16_t);
 typedef modbus_status_t set_uint32_t(uint32_t);
 typedef modbus_status_t set_bool_t(bool);
+typedef void get_int16_array_t(int16_t *);
+typedef void get_uint16_array_t(uint16_t *);
+typedef modbus_status_t set_int16_array_t(int16_t const *);
+typedef modbus_status_t set_uint16_array_t(uint16_t const *);
+
+// File records are read in chunks of count registers starting from
+// the given record number.
+typedef modbus_status_t get_file_t(uint16_t record, uint16_t *out, uint8_t count);
 
 // ASCII command interface. Sorted by command name.
 extern cmd_ascii_t const cmd_ascii[];
@@ -192,6 +192,56 @@ cmd_modbus_result_t cmd_bin_write_int32(char const *const buf_in, buflen_t count
 	return modbus_pass(sizeof(int32_t), f(val));
 }
 
+// Reads a string, padded with NUL bytes to the block length.
+cmd_modbus_result_t cmd_bin_read_string(char *const buf_out, buflen_t count, void const *getter, buflen_t len)
+{
+	if (count < len) return modbus_unaligned();
+
+	// The getter can write directly to the output since it
+	// writes the terminating NUL within the given length.
+	get_string_t *f = getter;
+	buflen_t wrote = f(buf_out, len);
+	if (wrote == BUFLEN_MAX) {
+		return modbus_pass(0, MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE);
+	}
+	if (wrote > len) wrote = len;
+	memset(buf_out + wrote, 0, len - wrote);
+
+	return modbus_pass(len, MODBUS_OK);
+}
+
+// Reads an array of 16 bit integers, signed or unsigned.
+cmd_modbus_result_t cmd_bin_read_int16_array(char *const buf_out, buflen_t count, void const *getter, uint8_t len)
+{
+	if (count < len * sizeof(int16_t)) return modbus_unaligned();
+
+	// Fill the output and swap endianness in place
+	get_int16_array_t *f = getter;
+	int16_t *buf = (int16_t*)buf_out;
+	f(buf);
+	for (uint8_t i = 0; i < len; i++) {
+		buf[i] = bswap_16(buf[i]);
+	}
+
+	return modbus_pass(len * sizeof(int16_t), MODBUS_OK);
+}
+
+// Writes an array of 16 bit integers, signed or unsigned. Partial
+// writes are not allowed.
+cmd_modbus_result_t cmd_bin_write_int16_array(char const *const buf_in, buflen_t count, void const *setter, uint8_t len)
+{
+	if (count < len * sizeof(int16_t)) return modbus_unaligned();
+
+	int16_t val[len];
+	int16_t const *buf = (int16_t const*)buf_in;
+	for (uint8_t i = 0; i < len; i++) {
+		val[i] = bswap_16(buf[i]);
+	}
+
+	set_int16_array_t *f = setter;
+	return modbus_pass(len * sizeof(int16_t), f(val));
+}
+
 static cmd_modbus_result_t modbus_unaligned()
 {
 	// Byte alignment error
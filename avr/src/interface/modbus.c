@@ -23,7 +23,10 @@
 #include <util/crc16.h>
 #include "modbus.h"
 #include "cmd.h"
+#include "ascii.h"
 #include "../byteswap.h"
+#include "../history.h"
+#include "../config.h"
 
 typedef buflen_t function_handler_t(char const *buf, buflen_t len, modbus_object_t type);
 
@@ -31,6 +34,7 @@ typedef struct {
 	uint8_t code;
 	function_handler_t *f;
 	modbus_object_t type;
+	function_handler_t *then; // Run after committing the changes
 } handler_t;
 
 static cmd_modbus_t const *find_cmd(modbus_object_t type, uint16_t addr);
@@ -39,6 +43,8 @@ static handler_t find_function_handler(uint8_t const code);
 static int handler_comparator(const void *key_void, const void *item_void);
 static modbus_status_t try_bit_write(uint16_t const addr, bool const value);
 static cmd_modbus_result_t try_register_write(uint16_t const addr, char const *buf_in, buflen_t const len);
+static modbus_status_t read_range(modbus_object_t const type, uint16_t const base_addr, uint16_t const registers, char *const buf_out, bool const with_inputs);
+static modbus_status_t write_range(uint16_t const base_addr, char const *const buf_in, buflen_t const bytes);
 static buflen_t fill_exception(modbus_status_t status);
 static cmd_modbus_result_t wrap_exception(modbus_status_t status);
 static uint16_t modbus_crc(char const *buf, buflen_t len);
@@ -48,6 +54,35 @@ static function_handler_t write_bit;
 static function_handler_t write_bits;
 static function_handler_t write_register;
 static function_handler_t write_registers;
+static function_handler_t read_file_record;
+static function_handler_t mask_write_register;
+static function_handler_t read_write_registers;
+static function_handler_t read_back_registers;
+static function_handler_t read_fifo;
+static function_handler_t ascii_tunnel;
+
+// Number of registers cached for repeated polls
+#define POLL_CACHE_ITEMS 8
+
+// Register read requests are typically repeated polls of the same
+// registers. The command lookups of the latest successful read are
+// cached so a repeated request skips the CRC check and the table
+// searches. The response itself can't be rendered in advance because
+// the _take_ getters reset the averaging on every read.
+typedef struct {
+	cmd_bin_read_t const *reader;
+	void const *getter;
+} plan_item_t;
+
+static struct {
+	char req[8];     // Request frame, including CRC
+	uint8_t items;   // Items in plan. 0 if invalid, over max if too many.
+	plan_item_t plan[POLL_CACHE_ITEMS];
+} poll_cache;
+
+static bool recording = false; // Is read_range() filling the cache?
+
+static buflen_t poll_cached(void);
 
 // Keep this list numerically sorted
 static handler_t const handlers[] PROGMEM = {
@@ -59,6 +94,11 @@ static handler_t const handlers[] PROGMEM = {
 	{ 0x06, &write_register},
 	{ 0x0F, &write_bits},
 	{ 0x10, &write_registers},
+	{ 0x14, &read_file_record},
+	{ 0x16, &mask_write_register},
+	{ 0x17, &read_write_registers, HOLDING_REGISTER, &read_back_registers},
+	{ 0x18, &read_fifo},
+	{ MODBUS_ASCII_TUNNEL, &ascii_tunnel},
 };
 
 // Search given command from the table generated to cmd.c
@@ -77,8 +117,13 @@ static int cmd_comparator(const void *key_void, const void *item_void)
 	cmd_modbus_t const *key = key_void;
 	cmd_modbus_t const *item_P = item_void;
 
-	// Doing partial comparison up to the actual payload
-	return memcmp_P(key, item_P, offsetof(cmd_modbus_t, action));
+	// Comparing the fields one by one because there may be
+	// padding between them on other platforms than AVR.
+	uint8_t const type = pgm_read_byte_near(&item_P->type);
+	if (key->type != type) return key->type < type ? -1 : 1;
+	uint16_t const addr = pgm_read_word_near(&item_P->addr);
+	if (key->addr != addr) return key->addr < addr ? -1 : 1;
+	return 0;
 }
 
 static handler_t find_function_handler(uint8_t const code)
@@ -99,7 +144,9 @@ static int handler_comparator(const void *key_void, const void *item_void)
 {
 	uint8_t const *key = key_void;
 	handler_t const *item_P = item_void;
-	return memcmp_P(key, item_P, offsetof(handler_t, f));
+	uint8_t const code = pgm_read_byte_near(&item_P->code);
+	if (*key != code) return *key < code ? -1 : 1;
+	return 0;
 }
 
 // Reads bits i.e. coils (function code 0x01) or input bits
@@ -176,39 +223,47 @@ static buflen_t read_registers(char const *buf, buflen_t len, modbus_object_t co
 	}
 	serial_tx[2] = 2*registers;
 
-	// Start the actual retrieval process
-	for (uint16_t i = 0; i < registers; ) {
-		// Retrieve suitable handler, if any
-		cmd_modbus_t const *cmd = find_cmd(type, base_addr+i);
-		if (cmd == NULL) {
-			return fill_exception(MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
-		}
+	// Start the actual retrieval process while recording the
+	// lookups to the poll cache.
+	poll_cache.items = 0;
+	recording = true;
+	modbus_status_t const code = read_range(type, base_addr, registers, serial_tx+tx_header_len, false);
+	recording = false;
+	if (code != MODBUS_OK) {
+		poll_cache.items = 0;
+		return fill_exception(code);
+	}
+	if (poll_cache.items <= POLL_CACHE_ITEMS) {
+		// Store the whole request frame
+		memcpy(poll_cache.req, buf-2, sizeof(poll_cache.req));
+	} else {
+		poll_cache.items = 0;
+	}
 
-		// Retrieving data from PROGMEM
-		cmd_bin_read_t const *reader = pgm_read_ptr_near(&(cmd->reader));
-		cmd_action_t const *action = pgm_read_ptr_near(&(cmd->action));
-		void const *getter = pgm_read_ptr_near(&(action->read));
-		if (reader == NULL) {
-			// Not readable
-			return fill_exception(MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
-		}
+	return tx_header_len + 2*registers;
+}
 
-		// Actual filling of data
-		cmd_modbus_result_t r = reader(serial_tx+tx_header_len+2*i, 2*(registers-i), getter);
+// Serve a request which is identical to the cached one.
+static buflen_t poll_cached(void)
+{
+	buflen_t const tx_header_len = 3;
+	buflen_t const bytes = 2 * bswap_16(*(uint16_t*)(poll_cache.req+4));
+
+	serial_tx[0] = poll_cache.req[0];
+	serial_tx[1] = poll_cache.req[1];
+	serial_tx[2] = bytes;
+
+	char *out = serial_tx + tx_header_len;
+	for (uint8_t i = 0; i < poll_cache.items; i++) {
+		plan_item_t const *p = poll_cache.plan + i;
+		cmd_modbus_result_t r = p->reader(out, serial_tx + tx_header_len + bytes - out, p->getter);
 		if (r.code != MODBUS_OK) {
-			// Passing error
 			return fill_exception(r.code);
 		}
-		if ((r.consumed & 1) != 0) {
-			// If the amount is not aligned to register
-			// width then something is bad.
-			return fill_exception(MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE);
-		}
-
-		i += r.consumed / 2;
+		out += r.consumed;
 	}
 
-	return tx_header_len + 2*registers;
+	return tx_header_len + bytes;
 }
 
 // Write bit i.e. force a single coil (function code 0x05)
@@ -349,19 +404,290 @@ static buflen_t write_registers(char const *buf, buflen_t len, modbus_object_t c
 	}
 	
 	// Start with base address and iterate until everything is got.
+	modbus_status_t const code = write_range(base_addr, buf+input_header_len, bytes);
+	if (code != MODBUS_OK) {
+		return fill_exception(code);
+	}
+	return 6;
+}
+
+// Mask write register (function code 0x16). Changes only the bits
+// which are not set in AND mask. The register must be a single
+// register wide.
+static buflen_t mask_write_register(char const *buf, buflen_t len, modbus_object_t const _)
+{
+	if (len != 6) {
+		return fill_exception(MODBUS_EXCEPTION_ILLEGAL_FUNCTION);
+	}
+
+	// Response payload is identical to the request
+	memcpy(serial_tx+2, buf, 6);
+
+	uint16_t const addr = bswap_16(*(uint16_t*)buf);
+	uint16_t const and_mask = bswap_16(*(uint16_t*)(buf+2));
+	uint16_t const or_mask = bswap_16(*(uint16_t*)(buf+4));
+
+	// Get the current value to the free space after the
+	// response. Fails if the register is wider than one
+	// register. Holding registers read the stored settings, so
+	// the target set by the schedule isn't stored as a side
+	// effect.
+	char *const cur = serial_tx + 8;
+	modbus_status_t code = read_range(HOLDING_REGISTER, addr, 1, cur, false);
+	if (code != MODBUS_OK) {
+		return fill_exception(code);
+	}
+
+	// Formula from Modbus specification
+	uint16_t value = bswap_16(*(uint16_t*)cur);
+	value = (value & and_mask) | (or_mask & ~and_mask);
+	value = bswap_16(value);
+
+	code = write_range(addr, (char*)&value, 2);
+	if (code != MODBUS_OK) {
+		return fill_exception(code);
+	}
+	return 8;
+}
+
+// Read/write multiple registers (function code 0x17). The write is
+// performed first and the read is done by read_back_registers() after
+// the changes have been committed, so the written values can be read
+// back. Input registers can be read, too, because they don't overlap
+// with holding registers. This allows setting values and polling
+// measurements in one request.
+static buflen_t read_write_registers(char const *buf, buflen_t len, modbus_object_t const _)
+{
+	buflen_t const input_header_len = 9;
+	buflen_t const tx_header_len = 3;
+
+	if (len < input_header_len) {
+		return fill_exception(MODBUS_EXCEPTION_ILLEGAL_FUNCTION);
+	}
+
+	uint16_t const registers = bswap_16(*(uint16_t*)(buf+2));
+	uint16_t const write_addr = bswap_16(*(uint16_t*)(buf+4));
+	uint16_t const write_registers = bswap_16(*(uint16_t*)(buf+6));
+	buflen_t const bytes = buf[8];
+
+	// Make sure all input data is there
+	if (input_header_len + bytes != len) {
+		return fill_exception(MODBUS_EXCEPTION_ILLEGAL_FUNCTION);
+	}
+	// Quantity limits by the specification
+	if (registers < 1 || registers > 0x7D ||
+	    write_registers < 1 || write_registers > 0x79 ||
+	    bytes != 2*write_registers) {
+		return fill_exception(MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE);
+	}
+	if (registers > (SERIAL_TX_LEN-tx_header_len-2) / 2) {
+		// Wouldn't fit to the output buffer
+		return fill_exception(MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE);
+	}
+
+	modbus_status_t const code = write_range(write_addr, buf+input_header_len, bytes);
+	if (code != MODBUS_OK) {
+		return fill_exception(code);
+	}
+	return tx_header_len;
+}
+
+// Read part of function code 0x17. The request has been validated by
+// read_write_registers().
+static buflen_t read_back_registers(char const *buf, buflen_t len, modbus_object_t const type)
+{
+	buflen_t const tx_header_len = 3;
+
+	uint16_t const read_addr = bswap_16(*(uint16_t*)buf);
+	uint16_t const registers = bswap_16(*(uint16_t*)(buf+2));
+
+	serial_tx[2] = 2*registers;
+	modbus_status_t const code = read_range(type, read_addr, registers, serial_tx+tx_header_len, true);
+	if (code != MODBUS_OK) {
+		return fill_exception(code);
+	}
+	return tx_header_len + 2*registers;
+}
+
+// Read file record (function code 0x14). Each sub-request reads a
+// range of records from a file. See commands.tsv for the files.
+static buflen_t read_file_record(char const *buf, buflen_t len, modbus_object_t const _)
+{
+	// Reference type, file number, record number and length
+	buflen_t const sub_len = 7;
+
+	if (len < 1 || (uint8_t)buf[0] != len - 1 || (uint8_t)buf[0] % sub_len != 0) {
+		return fill_exception(MODBUS_EXCEPTION_ILLEGAL_FUNCTION);
+	}
+
+	buflen_t out = 3;
+	for (buflen_t pos = 1; pos < len; pos += sub_len) {
+		char const *sub = buf + pos;
+		uint16_t const file = bswap_16(*(uint16_t*)(sub+1));
+		uint16_t const record = bswap_16(*(uint16_t*)(sub+3));
+		uint16_t const length = bswap_16(*(uint16_t*)(sub+5));
+
+		if (sub[0] != 6) {
+			return fill_exception(MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+		}
+		// Maximum by the specification. Checked before any
+		// arithmetic to avoid overflows.
+		if (length > 0x7B) {
+			return fill_exception(MODBUS_EXCEPTION_ILLEGAL_DATA_VALUE);
+		}
+		uint8_t const count = length;
+		if (out + 2 + 2*count + 2 > SERIAL_TX_LEN) {
+			// Wouldn't fit to the output buffer
+			return fill_exception(MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE);
+		}
+
+		cmd_modbus_t const *cmd = find_cmd(FILE_RECORD, file);
+		if (cmd == NULL) {
+			return fill_exception(MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+		}
+		cmd_action_t const *action = pgm_read_ptr_near(&(cmd->action));
+		get_file_t *getter = pgm_read_ptr_near(&(action->read));
+		if (getter == NULL) {
+			return fill_exception(MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS);
+		}
+
+		// Sub-response header: length and reference type
+		serial_tx[out++] = 1 + 2*count;
+		serial_tx[out++] = 6;
+
+		uint16_t *words = (uint16_t*)(serial_tx+out);
+		modbus_status_t const code = getter(record, words, count);
+		if (code != MODBUS_OK) {
+			return fill_exception(code);
+		}
+		for (uint8_t i = 0; i < count; i++) {
+			words[i] = bswap_16(words[i]);
+		}
+		out += 2*count;
+	}
+
+	serial_tx[2] = out - 3;
+	return out;
+}
+
+// Read FIFO queue (function code 0x18). The only queue is the
+// measurement history and the FIFO pointer address is the sequence
+// number of the first sample to read. See history.h for the format.
+static buflen_t read_fifo(char const *buf, buflen_t len, modbus_object_t const _)
+{
+	// Byte count and FIFO count
+	buflen_t const tx_header_len = 6;
+
+	if (len != 2) {
+		return fill_exception(MODBUS_EXCEPTION_ILLEGAL_FUNCTION);
+	}
+
+	uint16_t const seq = bswap_16(*(uint16_t*)buf);
+
+	// Modbus allows up to 31 registers in the queue. Leave space
+	// for CRC.
+	buflen_t space = SERIAL_TX_LEN - tx_header_len - 2;
+	if (space > 2*31) space = 2*31;
+
+	buflen_t const bytes = history_read(seq, serial_tx+tx_header_len, space);
+	*(uint16_t*)(serial_tx+2) = bswap_16(bytes + 2);
+	*(uint16_t*)(serial_tx+4) = bswap_16(bytes / 2);
+	return tx_header_len + bytes;
+}
+
+// ASCII command tunnel (user-defined function code 0x41). The
+// request payload is an ASCII command line without a line ending and
+// the response payload is the output, also without a line ending.
+static buflen_t ascii_tunnel(char const *buf, buflen_t len, modbus_object_t const _)
+{
+	if (!WITH_ASCII) {
+		return fill_exception(MODBUS_EXCEPTION_ILLEGAL_FUNCTION);
+	}
+
+	// ASCII interface modifies the input and wants a line
+	// ending. The frame is in the receive buffer and its CRC has
+	// been checked already, so the line is processed in place and
+	// the line ending replaces the CRC.
+	char *const line = (char *)buf;
+	line[len] = '\n';
+	ascii_interface_tunnel(line, len+1);
+
+	// The output is a string at the beginning of the serial
+	// buffer. Move it after the header and leave space for CRC.
+	buflen_t out = strnlen(serial_tx, SERIAL_TX_LEN);
+	if (out > SERIAL_TX_LEN - 4) out = SERIAL_TX_LEN - 4;
+	memmove(serial_tx+2, serial_tx, out);
+	serial_tx[0] = modbus_get_server_id();
+	serial_tx[1] = MODBUS_ASCII_TUNNEL;
+	return 2 + out;
+}
+
+// Helper for reading consecutive registers to the output buffer. If
+// with_inputs is set, input registers are looked up too.
+static modbus_status_t read_range(modbus_object_t const type, uint16_t const base_addr, uint16_t const registers, char *const buf_out, bool const with_inputs)
+{
+	for (uint16_t i = 0; i < registers; ) {
+		// Retrieve suitable handler, if any
+		cmd_modbus_t const *cmd = find_cmd(type, base_addr+i);
+		if (cmd == NULL && with_inputs) {
+			cmd = find_cmd(INPUT_REGISTER, base_addr+i);
+		}
+		if (cmd == NULL) {
+			return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+		}
+
+		// Retrieving data from PROGMEM
+		cmd_bin_read_t const *reader = pgm_read_ptr_near(&(cmd->reader));
+		cmd_action_t const *action = pgm_read_ptr_near(&(cmd->action));
+		void const *getter = pgm_read_ptr_near(&(action->read));
+		if (reader == NULL) {
+			// Not readable
+			return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+		}
+
+		// Remember the lookup for repeated polls
+		if (recording && poll_cache.items <= POLL_CACHE_ITEMS) {
+			if (poll_cache.items < POLL_CACHE_ITEMS) {
+				plan_item_t *p = poll_cache.plan + poll_cache.items;
+				p->reader = reader;
+				p->getter = getter;
+			}
+			poll_cache.items++;
+		}
+
+		// Actual filling of data
+		cmd_modbus_result_t r = reader(buf_out+2*i, 2*(registers-i), getter);
+		if (r.code != MODBUS_OK) {
+			// Passing error
+			return r.code;
+		}
+		if ((r.consumed & 1) != 0) {
+			// If the amount is not aligned to register
+			// width then something is bad.
+			return MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE;
+		}
+
+		i += r.consumed / 2;
+	}
+	return MODBUS_OK;
+}
+
+// Helper for writing consecutive registers from the input buffer.
+static modbus_status_t write_range(uint16_t const base_addr, char const *const buf_in, buflen_t const bytes)
+{
 	for (buflen_t i=0; i < bytes; ) {
-		cmd_modbus_result_t r = try_register_write(base_addr+i/2, buf+input_header_len+i, bytes-i);
+		cmd_modbus_result_t r = try_register_write(base_addr+i/2, buf_in+i, bytes-i);
 		if (r.code != MODBUS_OK) {
-			return fill_exception(r.code);
+			return r.code;
 		}
 		if ((r.consumed & 1) != 0) {
 			// If the amount is not aligned to register
 			// width then something is bad.
-			return fill_exception(MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE);
+			return MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE;
 		}
 		i += r.consumed;
 	}
-	return 6;
+	return MODBUS_OK;
 }
 
 // Helper for register writes, contains the actual write logic.
@@ -392,7 +718,7 @@ uint8_t modbus_get_server_id(void)
 	return 1;
 }
 
-#if SERIAL_TX_LEN < 8
+#if SERIAL_TX_LEN < 10
 #error Modbus exceptions and typical answers require longer serial tx buffer
 #endif
 
@@ -424,23 +750,41 @@ static uint16_t modbus_crc(char const *buf, buflen_t len)
 	return crc;
 }
 
-buflen_t modbus_interface(char *buf, buflen_t len)
+bool modbus_crc_ok(char const *buf, buflen_t len)
 {
-	// Let's start with RTU structure https://en.wikipedia.org/wiki/Modbus
-	
-	// Drop clearly invalid data
-	if (len < 6) return 0;
-
-	// Check if targeted to us
-	if (buf[0] != modbus_get_server_id()) return 0;
+	if (len < 4) return false;
 
 	// Collect checksum. NOTE: It is little-endian on wire!
 	len -= 2;
 	uint16_t const crc_correct = *(uint16_t*)(buf+len);
 
 	// Calculate CRC. If it's incorrect, stop processing the frame
-	uint16_t const crc_in = modbus_crc(buf, len);
-	if (crc_in != crc_correct) return 0;
+	return modbus_crc(buf, len) == crc_correct;
+}
+
+bool modbus_is_frame(char const *buf, buflen_t len)
+{
+	// Check if targeted to us
+	return len >= 4 && buf[0] == modbus_get_server_id() &&
+		modbus_crc_ok(buf, len);
+}
+
+__attribute__((noinline, noclone))
+buflen_t modbus_interface(char *buf, buflen_t len)
+{
+	// Let's start with RTU structure https://en.wikipedia.org/wiki/Modbus
+	buflen_t ret;
+
+	// A repeated poll has been validated already.
+	if (len == sizeof(poll_cache.req) && poll_cache.items != 0 &&
+	    memcmp(buf, poll_cache.req, len) == 0) {
+		ret = poll_cached();
+		goto crc;
+	}
+
+	// Drop invalid data and messages to other servers
+	if (len < 6 || !modbus_is_frame(buf, len)) return 0;
+	len -= 2;
 
 	// Start collecting the answer
 	serial_tx[0] = buf[0];
@@ -449,18 +793,28 @@ buflen_t modbus_interface(char *buf, buflen_t len)
 
 	// Find handler for function code
 	handler_t handler = find_function_handler(function_code);
-	buflen_t ret;
 	if (handler.f == NULL) {
 		// Illegal function. Producing reply packet
 		ret = fill_exception(MODBUS_EXCEPTION_ILLEGAL_FUNCTION);
 	} else {
+		// Configuration changes are committed once per frame
+		// and only if the whole request succeeds.
+		config_begin();
 		ret = handler.f(buf+2, len-2, handler.type);
 		if (ret+2 > SERIAL_TX_LEN) {
 			// Cannot fit CRC
 			ret = fill_exception(MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE);
 		}
+		bool const ok = !(serial_tx[1] & 0x80);
+		config_end(ok);
+
+		// The first part has checked the response fits.
+		if (ok && handler.then != NULL) {
+			ret = handler.then(buf+2, len-2, handler.type);
+		}
 	}
 
+ crc:
 	// Outbound CRC is written little-endian
 	uint16_t crc_out = modbus_crc(serial_tx, ret);
 	*(uint16_t*)(serial_tx+ret) = crc_out;
@@ -4,9 +4,20 @@
 
 #include "../serial.h"
 
+// User-defined function code for tunnelling ASCII commands
+#define MODBUS_ASCII_TUNNEL 0x41
+
 // Return current Modbus server ID
 uint8_t modbus_get_server_id(void);
 
 // Processes given input and performs the Modbus operations in
 // there. If returns 0, doesn't want to give any response.
 buflen_t modbus_interface(char *buf, buflen_t len);
+
+// Tests if the message has a valid Modbus CRC, regardless of the
+// server ID.
+bool modbus_crc_ok(char const *buf, buflen_t len);
+
+// Tests if the message is a Modbus frame addressed to us, i.e. it
+// has our server ID and a valid CRC.
+bool modbus_is_frame(char const *buf, buflen_t len);
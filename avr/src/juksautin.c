@@ -17,9 +17,13 @@
 
 #include <stdbool.h>
 #include <stdint.h>
-#include <avr/eeprom.h>
+#include <stddef.h>
+#include <string.h>
 #include <util/atomic.h>
 #include "adc.h"
+#include "blink.h"
+#include "task.h"
+#include "config.h"
 #include "pin.h"
 #include "juksautin.h"
 #include "hardware_config.h"
@@ -46,62 +50,247 @@ typedef struct {
 	uint16_t count;
 } accu_t;
 
+// Accumulators of a juksautus line
+typedef struct {
+	accu_t raw;   // Real voltage in the line
+	accu_t ratio; // Juksautin ratio
+} line_accus_t;
+
 // Struct of accumulators
 typedef struct {
-	accu_t k5_raw;           // Real voltage in K5
+	line_accus_t line[JUKSAUTIN_LINES];
 	accu_t int_temp;         // AVR internal temperature
 	accu_t outside_temp;     // Outside thermistor temp
 	accu_t accumulator_temp; // Accumulator tank thermistor temp
-	accu_t juksautin;        // Juksautin ratio
 	int16_t err;             // Error led high value
 } accus_t;
 
+// Offset of a field of line_accus_t in accus_t for store_all()
+#define LINE_FIELD(i, field) (offsetof(accus_t, line) + (i) * sizeof(line_accus_t) + offsetof(line_accus_t, field))
+
+// Windowed statistics of a channel since the previous take. Sums are
+// kept in raw ADC units. Halved like accu_t when the count runs out,
+// which keeps the mean and the variance but not the exact window.
+typedef struct {
+	uint16_t min;
+	uint16_t max;
+	uint16_t count;
+	uint32_t sum;
+	uint64_t sum_sq; // Sum of squares
+} window_t;
+
+// Channels with windowed statistics. Juksautus lines are the last.
+typedef enum {
+	WINDOW_ACCUMULATOR,
+	WINDOW_OUTSIDE,
+	WINDOW_ERROR,
+	WINDOW_LINE,
+	WINDOW_COUNT = WINDOW_LINE + JUKSAUTIN_LINES,
+} window_channel_t;
+
+// Juksautus line descriptor. See hardware_config.h.
+typedef struct {
+	uint8_t adc;            // ADC input of the thermistor line
+	volatile uint8_t *ddr;  // Data direction register of the drive pin
+	volatile uint8_t *port; // Output register of the drive pin
+	uint8_t mask;           // Bit of the drive pin
+	adc_handler_t handler;  // Calls handle_line() with the line number
+} line_desc_t;
+
+// Every consumer of the measurements has its own bank of
+// accumulators. That way the history recorder doesn't steal the data
+// from the command interface and vice versa.
+typedef enum {
+	BANK_POLL,    // Read by the command interface
+	BANK_HISTORY, // Read by the history recorder
+	BANK_COUNT,
+} bank_t;
+
 // Static prototypes
 static uint16_t to_millivolts(accu_t a);
 static uint16_t to_ratio16(accu_t a);
 static accu_t take_accu(volatile accu_t *p);
-static void handle_juksautus(uint16_t val);
+static void handle_k5(uint16_t val);
+#ifdef LINE_K9_ADC
+static void handle_k9(uint16_t val);
+#endif
 static void handle_int_temp(uint16_t val);
 static void handle_outside_temp(uint16_t val);
 static void handle_accumulator_temp(uint16_t val);
 static void handle_err(uint16_t val);
+static void store_int_temp(uint16_t val);
+static void store_outside_temp(uint16_t val);
+static void store_accumulator_temp(uint16_t val);
+static void store_err(uint16_t val);
 static void store(volatile accu_t *a, uint16_t const val, uint32_t const max);
+static void store_all(size_t const field, uint16_t const val, uint32_t const max);
+static uint16_t take_error(bank_t const bank);
+static void capture(uint16_t val);
+static uint16_t mv_to_raw(uint16_t mv);
+static uint16_t raw_to_mv(uint32_t raw);
+static void window_add(window_channel_t const ch, uint16_t const val);
+static void take_window(window_channel_t const ch, uint16_t *const out);
+static uint32_t isqrt(uint64_t x);
+
+// Juksautus lines. The target in the configuration has the same index.
+static line_desc_t const lines[JUKSAUTIN_LINES] = {
+	{ LINE_K5_ADC, DDR_ADDR(LINE_K5_PIN), PORT_ADDR(LINE_K5_PIN), PIN_MASK(LINE_K5_PIN), handle_k5 },
+#ifdef LINE_K9_ADC
+	{ LINE_K9_ADC, DDR_ADDR(LINE_K9_PIN), PORT_ADDR(LINE_K9_PIN), PIN_MASK(LINE_K9_PIN), handle_k9 },
+#endif
+};
 
 // Static values
-static volatile accus_t v_accu; // Holds all volatile measurement data
-static volatile uint16_t target; // Target voltage for juksautus
-static uint16_t ee_target EEMEM = 1000l * MV_DIV / MV_MULT; // EEPROM initial value is 1 V
+static volatile accus_t v_accu[BANK_COUNT]; // Holds all volatile measurement data
+static volatile uint16_t target[JUKSAUTIN_LINES]; // Target voltage for juksautus
+static volatile window_t windows[WINDOW_COUNT]; // Read by the command interface
 
 // Not volatile because used only inside ISRs
-static bool juksautus = false; // Is juksautus on at the moment?
+static bool juksautus[JUKSAUTIN_LINES]; // Is juksautus on at the moment?
+static bool k5_gap = true;     // Was the previous conversion from another channel?
+
+// Oscilloscope mode. Samples are raw ADC values with CAPTURE_DRIVE
+// and CAPTURE_GAP flags.
+typedef enum {
+	CAPTURE_IDLE,    // Buffer is ready for reading
+	CAPTURE_ARMED,   // Waiting for the signal to cross capture_level
+	CAPTURE_RUNNING, // Filling the buffer
+} capture_state_t;
+
+static uint16_t capture_buf[CAPTURE_LEN];
+static uint16_t capture_pos;
+static volatile capture_state_t capture_state = CAPTURE_IDLE;
+static volatile uint16_t capture_level = 0; // Trigger level. 0 means immediate.
+static uint16_t capture_prev; // Previous sample, used for level crossing
+#define NO_SAMPLE 0xFFFF       // Never returned by 10-bit ADC
 
 void juksautin_init(void)
 {
-	adc_set_handler(0, handle_juksautus);
+	// Drive pins are toggled between HI-Z and LOW. Start with HI-Z.
+	for (uint8_t i = 0; i < JUKSAUTIN_LINES; i++) {
+		*lines[i].port &= ~lines[i].mask;
+		*lines[i].ddr &= ~lines[i].mask;
+		adc_set_handler(lines[i].adc, lines[i].handler);
+	}
 	adc_set_handler(8, handle_int_temp);
 	adc_set_handler(3, handle_outside_temp);
 	adc_set_handler(4, handle_accumulator_temp);
 	adc_set_handler(2, handle_err);
 
-	// Retrieve target from EEPROM
-	target = eeprom_read_word(&ee_target);
+	// Start with the configured target
+	juksautin_reconfigure();
+}
+
+// Lines whose target has been written with juksautin_set_target()
+// but not yet applied. They are pushed even when the stored value
+// doesn't change.
+static bool written[JUKSAUTIN_LINES];
+
+modbus_status_t juksautin_set_target(uint8_t const line, uint16_t const mv)
+{
+	config.target[line] = mv_to_raw(mv);
+	written[line] = true;
+	config_commit();
+	return MODBUS_OK;
+}
+
+void juksautin_apply_target(uint8_t const line, uint16_t const mv)
+{
+	uint16_t const new_target = mv_to_raw(mv);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		target[line] = new_target;
+	}
+}
+
+void juksautin_reconfigure(void)
+{
+	// Apply only if written or changed to keep the target set by
+	// juksautin_apply_target() in effect.
+	static uint16_t applied[JUKSAUTIN_LINES];
+	static bool initialized = false;
+	for (uint8_t i = 0; i < JUKSAUTIN_LINES; i++) {
+		bool const push = written[i] || config.target[i] != applied[i];
+		written[i] = false;
+		if (initialized && !push) continue;
+		applied[i] = config.target[i];
+
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			target[i] = applied[i];
+		}
+	}
+	initialized = true;
+}
+
+void juksautin_forget_writes(void)
+{
+	memset(written, 0, sizeof(written));
+}
+
+modbus_status_t juksautin_set_capture(bool const on)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (on) {
+			capture_pos = 0;
+			capture_prev = NO_SAMPLE;
+			capture_state = capture_level ? CAPTURE_ARMED : CAPTURE_RUNNING;
+		} else {
+			capture_state = CAPTURE_IDLE;
+		}
+	}
+	return MODBUS_OK;
 }
 
-modbus_status_t juksautin_set_target(uint16_t const mv)
+bool juksautin_get_capture(void)
 {
-	uint16_t new_target = ((uint32_t)mv * MV_DIV + MV_DIV / 2) / MV_MULT;
+	return capture_state != CAPTURE_IDLE;
+}
+
+modbus_status_t juksautin_set_capture_level(uint16_t const mv)
+{
+	uint16_t const level = mv_to_raw(mv);
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-		target = new_target;
+		capture_level = level;
 	}
-	eeprom_update_word(&ee_target, new_target);
 	return MODBUS_OK;
 }
 
-uint16_t juksautin_get_target(void)
+uint16_t juksautin_get_capture_level(void)
 {
 	uint32_t raw;
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-		raw = target;
+		raw = capture_level;
+	}
+	return (raw * MV_MULT + MV_MULT / 2) / MV_DIV;
+}
+
+uint16_t juksautin_get_capture_len(void)
+{
+	return CAPTURE_LEN;
+}
+
+modbus_status_t juksautin_capture_read(uint16_t const record, uint16_t *const out, uint8_t const count)
+{
+	if (capture_state != CAPTURE_IDLE) {
+		return MODBUS_EXCEPTION_SLAVE_OR_SERVER_BUSY;
+	}
+	if (record >= CAPTURE_LEN || count > CAPTURE_LEN - record) {
+		return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+	}
+	memcpy(out, capture_buf + record, count * sizeof(*out));
+	return MODBUS_OK;
+}
+
+uint16_t juksautin_get_target(uint8_t const line)
+{
+	uint32_t const raw = config.target[line];
+	return (raw * MV_MULT + MV_MULT / 2) / MV_DIV;
+}
+
+uint16_t juksautin_get_applied_target(uint8_t const line)
+{
+	uint32_t raw;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		raw = target[line];
 	}
 	return (raw * MV_MULT + MV_MULT / 2) / MV_DIV;
 }
@@ -112,35 +301,73 @@ float juksautin_compute_k5_real_voltage(float mv, float ratio, float um, float r
 	return 1 / (((um / mv - 1) / rm) - (ratio / 200));
 }
 
-uint16_t juksautin_take_k5_raw_mv(void)
+uint16_t juksautin_take_raw_mv(uint8_t const line)
 {
-	return to_millivolts(take_accu(&v_accu.k5_raw));
+	return to_millivolts(take_accu(&v_accu[BANK_POLL].line[line].raw));
 }
 
-uint16_t juksautin_take_ratio(void)
+uint16_t juksautin_take_ratio(uint8_t const line)
 {
-	return to_ratio16(take_accu(&v_accu.juksautin));
+	return to_ratio16(take_accu(&v_accu[BANK_POLL].line[line].ratio));
 }
 
 uint16_t juksautin_take_error(void)
 {
-	uint16_t error;
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-		// Copy and empty it atomically.
-		error = v_accu.err;
-		v_accu.err = 0;
-	}
-	return error;
+	return take_error(BANK_POLL);
 }
 
 uint16_t juksautin_take_outside_temp(void)
 {
-	return to_millivolts(take_accu(&v_accu.outside_temp));
+	return to_millivolts(take_accu(&v_accu[BANK_POLL].outside_temp));
 }
 
 uint16_t juksautin_take_accumulator_temp(void)
 {
-	return to_millivolts(take_accu(&v_accu.accumulator_temp));
+	return to_millivolts(take_accu(&v_accu[BANK_POLL].accumulator_temp));
+}
+
+void juksautin_take_line_window(uint8_t const line, uint16_t *const out)
+{
+	take_window(WINDOW_LINE + line, out);
+}
+
+void juksautin_take_accumulator_window(uint16_t *const out)
+{
+	take_window(WINDOW_ACCUMULATOR, out);
+}
+
+void juksautin_take_outside_window(uint16_t *const out)
+{
+	take_window(WINDOW_OUTSIDE, out);
+}
+
+void juksautin_take_error_window(uint16_t *const out)
+{
+	take_window(WINDOW_ERROR, out);
+}
+
+void juksautin_take_sample(uint16_t *const out)
+{
+	volatile accus_t *const p = &v_accu[BANK_HISTORY];
+
+	out[0] = to_millivolts(take_accu(&p->line[0].raw));
+	out[1] = to_ratio16(take_accu(&p->line[0].ratio));
+	out[2] = to_millivolts(take_accu(&p->accumulator_temp));
+	out[3] = to_millivolts(take_accu(&p->outside_temp));
+	out[4] = take_error(BANK_HISTORY);
+	out[5] = juksautin_get_applied_target(0);
+}
+
+// Take (read and empty) error LED high value from given bank.
+static uint16_t take_error(bank_t const bank)
+{
+	uint16_t error;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		// Copy and empty it atomically.
+		error = v_accu[bank].err;
+		v_accu[bank].err = 0;
+	}
+	return error;
 }
 
 // Take (read and empty) analog accumulator.
@@ -156,6 +383,40 @@ static accu_t take_accu(volatile accu_t *p)
 	return a;
 }
 
+// Take (read and empty) the windowed statistics of a channel and
+// output minimum, maximum, mean and standard deviation in
+// millivolts. All are zero if there are no samples.
+static void take_window(window_channel_t const ch, uint16_t *const out)
+{
+	window_t w;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		// Copy and empty it atomically.
+		w = windows[ch];
+		windows[ch].count = 0;
+		windows[ch].sum = 0;
+		windows[ch].sum_sq = 0;
+	}
+
+	if (w.count == 0) {
+		memset(out, 0, 4 * sizeof(*out));
+		return;
+	}
+
+	// n^2 times the variance, without divisions. Scaled by 2^8 to
+	// get the deviation in 1/16 raw units. Halving the sums rounds
+	// them separately, which may make the difference negative when
+	// the samples are nearly constant.
+	uint64_t const sq_n = w.count * w.sum_sq;
+	uint64_t const sum2 = (uint64_t)w.sum * w.sum;
+	uint64_t const var_n2 = sq_n > sum2 ? sq_n - sum2 : 0;
+	uint32_t const dev16 = isqrt(var_n2 << 8) / w.count;
+
+	out[0] = raw_to_mv(w.min);
+	out[1] = raw_to_mv(w.max);
+	out[2] = raw_to_mv((w.sum << 4) / w.count) / 16;
+	out[3] = raw_to_mv(dev16) / 16;
+}
+
 // Convert accumulator value to arithmetic mean millivolts.
 static uint16_t to_millivolts(accu_t a)
 {
@@ -178,7 +439,9 @@ uint8_t adc_channel_selection(void)
 	// thermistor value while juksautus is happening. We calculate
 	// juksautus count by counting the periods of time the current
 	// is flowing.
-	store(&v_accu.juksautin, juksautus, accu_bool_sum_max);
+	for (uint8_t i = 0; i < JUKSAUTIN_LINES; i++) {
+		store_all(LINE_FIELD(i, ratio), juksautus[i], accu_bool_sum_max);
+	}
 
 	// Now the actual selection. We use cycle length of 16
 	static uint8_t cycle = 0;
@@ -197,47 +460,181 @@ uint8_t adc_channel_selection(void)
 		// Tank temperature measurement
 		return 4;
 	default:
-		// NTC thermistor measurement
-		return 0;
+		// NTC thermistor measurement, taking turns if there
+		// are multiple lines.
+		if (JUKSAUTIN_LINES == 1) return lines[0].adc;
+		static uint8_t line = 0;
+		if (++line == JUKSAUTIN_LINES) line = 0;
+		return lines[line].adc;
 	}
 }
 
 // Now follows ADC measurement handlers. Thoese functions are called
-// from ADC interrupt handler.
-
-static void handle_juksautus(uint16_t val)
+// from ADC interrupt handler. Only the juksautus line handlers do
+// their work in the interrupt because they drive the pump, and the
+// error LED handler runs the blink code decoder. The others defer
+// the work to the main loop. Their data is averaged, so losing a
+// sample when the task queue is full is harmless.
+
+// Juksautus line handler. Inlined to the per line handlers below so
+// the line number is a constant.
+__attribute__((always_inline))
+static inline void handle_line(uint8_t const i, uint16_t const val)
 {
 	// Pump logic. Pull capacitor down to target voltage.
-	juksautus = val > target;
-	if (juksautus) {
-		OUTPUT(PIN_FB);
+	bool const on = val > target[i];
+	juksautus[i] = on;
+	if (on) {
+		*lines[i].ddr |= lines[i].mask;
 	} else {
-		INPUT(PIN_FB);
+		*lines[i].ddr &= ~lines[i].mask;
 	}
 
 	// Store measurement
-	store(&v_accu.k5_raw, val, accu_mv_sum_max);
+	store_all(LINE_FIELD(i, raw), val, accu_mv_sum_max);
+	window_add(WINDOW_LINE + i, val);
+
+	// Only K5 line can be captured
+	if (i == 0) {
+		if (capture_state != CAPTURE_IDLE) capture(val);
+		k5_gap = false;
+	} else {
+		k5_gap = true;
+	}
 }
 
+static void handle_k5(uint16_t val)
+{
+	handle_line(0, val);
+}
+
+#ifdef LINE_K9_ADC
+static void handle_k9(uint16_t val)
+{
+	handle_line(1, val);
+}
+#endif
+
 static void handle_int_temp(uint16_t val)
 {
-	store(&v_accu.int_temp, val, accu_mv_sum_max);
+	k5_gap = true;
+	task_post(TASK_LOW, store_int_temp, val);
 }
 
 static void handle_outside_temp(uint16_t val)
 {
-	store(&v_accu.outside_temp, val, accu_mv_sum_max);
+	k5_gap = true;
+	task_post(TASK_LOW, store_outside_temp, val);
 }
 
 static void handle_accumulator_temp(uint16_t val)
 {
-	store(&v_accu.accumulator_temp, val, accu_mv_sum_max);
+	k5_gap = true;
+	task_post(TASK_LOW, store_accumulator_temp, val);
 }
 
 static void handle_err(uint16_t val)
 {
-	if (v_accu.err >= val) return;
-	v_accu.err = val;
+	k5_gap = true;
+	// The decoder measures durations, so it can't be deferred.
+	blink_sample(val);
+	task_post(TASK_LOW, store_err, val);
+}
+
+// Deferred parts of the handlers above. Called from the main loop.
+
+static void store_int_temp(uint16_t val)
+{
+	store_all(offsetof(accus_t, int_temp), val, accu_mv_sum_max);
+}
+
+static void store_outside_temp(uint16_t val)
+{
+	store_all(offsetof(accus_t, outside_temp), val, accu_mv_sum_max);
+	window_add(WINDOW_OUTSIDE, val);
+}
+
+static void store_accumulator_temp(uint16_t val)
+{
+	store_all(offsetof(accus_t, accumulator_temp), val, accu_mv_sum_max);
+	window_add(WINDOW_ACCUMULATOR, val);
+}
+
+static void store_err(uint16_t val)
+{
+	window_add(WINDOW_ERROR, val);
+	for (bank_t b = 0; b < BANK_COUNT; b++) {
+		if (v_accu[b].err < val) v_accu[b].err = val;
+	}
+}
+
+// Oscilloscope mode. Waits for the trigger if armed and fills the
+// capture buffer.
+static void capture(uint16_t val)
+{
+	if (capture_state == CAPTURE_ARMED) {
+		// Trigger when the signal crosses the level to either
+		// direction. The first sample only primes the comparison.
+		bool const crossed = capture_prev != NO_SAMPLE &&
+			(val >= capture_level) != (capture_prev >= capture_level);
+		capture_prev = val;
+		if (!crossed) return;
+		capture_state = CAPTURE_RUNNING;
+	}
+
+	capture_buf[capture_pos++] = val |
+		(juksautus[0] ? CAPTURE_DRIVE : 0) |
+		(k5_gap ? CAPTURE_GAP : 0);
+	if (capture_pos == CAPTURE_LEN) {
+		capture_state = CAPTURE_IDLE;
+	}
+}
+
+// Convert millivolts to raw ADC units.
+static uint16_t mv_to_raw(uint16_t const mv)
+{
+	return ((uint32_t)mv * MV_DIV + MV_DIV / 2) / MV_MULT;
+}
+
+// Convert raw ADC units to millivolts, rounded.
+static uint16_t raw_to_mv(uint32_t const raw)
+{
+	return (raw * MV_MULT + MV_DIV / 2) / MV_DIV;
+}
+
+// Update the windowed statistics of a channel. Constant time, so it
+// can be called from the line handlers.
+static void window_add(window_channel_t const ch, uint16_t const val)
+{
+	volatile window_t *const w = windows + ch;
+	if (w->count == 0 || val < w->min) w->min = val;
+	if (w->count == 0 || val > w->max) w->max = val;
+	w->sum += val;
+	w->sum_sq += (uint32_t)val * val;
+	if (++w->count == 0) {
+		// Out of headroom in the counter
+		w->count = 1 << 15;
+		w->sum >>= 1;
+		w->sum_sq >>= 1;
+	}
+}
+
+// Integer square root, rounded down.
+static uint32_t isqrt(uint64_t x)
+{
+	uint64_t root = 0;
+	uint64_t bit = (uint64_t)1 << 62;
+	while (bit > x) bit >>= 2;
+	while (bit != 0) {
+		if (x >= root + bit) {
+			x -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return root;
 }
 
 // Update cumulative analog value for access outside the ISR.
@@ -261,3 +658,12 @@ static void store(volatile accu_t *a, uint16_t const val, uint32_t const max)
 		a->count >>= 1;
 	}
 }
+
+// Store the value to the given accumulator field in every bank. Field
+// is given as an offset to accus_t, obtained using offsetof().
+static void store_all(size_t const field, uint16_t const val, uint32_t const max)
+{
+	for (bank_t b = 0; b < BANK_COUNT; b++) {
+		store((volatile accu_t *)((volatile char *)&v_accu[b] + field), val, max);
+	}
+}
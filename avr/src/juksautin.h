@@ -1,7 +1,13 @@
 #pragma once
 
+#include <stdbool.h>
 #include "modbus_types.h"
 
+// Flags in the capture samples. The lowest 10 bits contain the raw
+// ADC value of K5 line.
+#define CAPTURE_DRIVE 0x8000 // Juksautus was on after this sample
+#define CAPTURE_GAP   0x4000 // Another channel was sampled before this
+
 // Functions specific to Pumpunjuksautin. NB! Functions with _take_ in
 // the name read and empty the internal average counter.
 
@@ -9,13 +15,33 @@
 // (target voltage 1.0V).
 void juksautin_init(void);
 
-// Set given target voltage to K5 line in millivolts. The electronics
+// Functions taking a line number operate on the juksautus line of
+// that index in hardware_config.h, K5 line being 0. The command
+// interface calls them via the register banks in commands.tsv.
+
+// Set given target voltage to the line in millivolts. The electronics
 // can only do pulldown so it make voltage lower and therefore make
 // the measured temperature higher (NTC thermistor)
-modbus_status_t juksautin_set_target(uint16_t mv);
+modbus_status_t juksautin_set_target(uint8_t line, uint16_t mv);
+
+// As juksautin_set_target() but doesn't change the configuration,
+// so the target is not stored to EEPROM.
+void juksautin_apply_target(uint8_t line, uint16_t mv);
+
+// Apply the targets from the configuration if they have changed or
+// have been written with juksautin_set_target().
+void juksautin_reconfigure(void);
 
-// Get previously set target voltage of K5 line in millivolts.
-uint16_t juksautin_get_target(void);
+// Forget the targets written with juksautin_set_target() when the
+// configuration changes are rolled back.
+void juksautin_forget_writes(void);
+
+// Get the stored target voltage of the line in millivolts.
+uint16_t juksautin_get_target(uint8_t line);
+
+// Get the target voltage in effect, which may have been set by
+// juksautin_apply_target(), in millivolts.
+uint16_t juksautin_get_applied_target(uint8_t line);
 
 // Calculate voltage in K5 line as if no juksautus was active. It is
 // calculated from the measured voltage mv, juksautus ratio, thermal
@@ -23,11 +49,11 @@ uint16_t juksautin_get_target(void);
 // rm. Units are in volts and ohms.
 float juksautin_compute_k5_normal_voltage(float mv, float ratio, float um, float rm);
 
-// Get current K5 temperature sensor value in millivolts.
-uint16_t juksautin_take_k5_raw_mv(void);
+// Get current temperature sensor value of the line in millivolts.
+uint16_t juksautin_take_raw_mv(uint8_t line);
 
-// Get juksautin duty cycle in range 0-65535.
-uint16_t juksautin_take_ratio(void);
+// Get juksautin duty cycle of the line in range 0-65535.
+uint16_t juksautin_take_ratio(uint8_t line);
 
 // Get error LED high value. TODO: Should we return bool instead?
 uint16_t juksautin_take_error(void);
@@ -37,3 +63,46 @@ uint16_t juksautin_take_outside_temp(void);
 
 // Get accumulator tank temperature
 uint16_t juksautin_take_accumulator_temp(void);
+
+// Number of values produced by the _window functions.
+#define JUKSAUTIN_WINDOW_LEN 4
+
+// Take the statistics of a measurement since the previous call to the
+// given array: minimum, maximum, mean and standard deviation, all in
+// millivolts. Catches the spikes and ripple which are lost in the
+// plain averages.
+void juksautin_take_line_window(uint8_t line, uint16_t *out);
+void juksautin_take_accumulator_window(uint16_t *out);
+void juksautin_take_outside_window(uint16_t *out);
+void juksautin_take_error_window(uint16_t *out);
+
+// Number of values produced by juksautin_take_sample().
+#define JUKSAUTIN_SAMPLE_LEN 6
+
+// Take all measurements at once to the given array in the following
+// order: k5_raw, ratio, accu, out, error, and target. Uses a separate
+// set of averaging counters, so it doesn't interfere with the other
+// _take_ functions.
+void juksautin_take_sample(uint16_t *out);
+
+// Start (true) or stop (false) the oscilloscope mode. When started,
+// waits for K5 voltage to cross the capture level and then records
+// CAPTURE_LEN successive K5 samples. Each K5 conversion takes 104µs.
+modbus_status_t juksautin_set_capture(bool on);
+
+// Is the capture armed or running?
+bool juksautin_get_capture(void);
+
+// Set capture trigger level in millivolts. If zero, the capture
+// starts immediately.
+modbus_status_t juksautin_set_capture_level(uint16_t mv);
+
+// Get capture trigger level in millivolts.
+uint16_t juksautin_get_capture_level(void);
+
+// Get the number of samples in the capture buffer.
+uint16_t juksautin_get_capture_len(void);
+
+// Copy count samples starting from sample number record to out. The
+// capture must be finished before reading.
+modbus_status_t juksautin_capture_read(uint16_t record, uint16_t *out, uint8_t count);
@@ -25,6 +25,13 @@
 #include "serial.h"
 #include "clock.h"
 #include "juksautin.h"
+#include "history.h"
+#include "schedule.h"
+#include "store.h"
+#include "config.h"
+#include "task.h"
+#include "sram.h"
+#include "stats.h"
 #include "pin.h"
 #include "hardware_config.h"
 #include "interface/ascii.h"
@@ -32,20 +39,26 @@
 
 // Prototypes
 static void loop(void);
+static void post_periodic(void);
+static void periodic(uint16_t _);
+
+// Once per second timer for the periodic tasks
+static clock_timer_t periodic_timer = { .f = post_periodic };
 
 // Initialization
 int main() {
-	// FB pin is toggled between HI-Z and LOW, prepare it. Start with HI-Z.
-	LOW(PIN_FB);
-	INPUT(PIN_FB);
-
 	// Configure output pins
 	OUTPUT(PIN_LED);
 
 	// Initialize modules.
+	stats_init();
 	serial_init();
+	store_init();
+	config_init();
 	clock_init();
+	clock_timer_start(&periodic_timer, CLOCK_MS(1000), CLOCK_MS(1000));
 	juksautin_init();
+	schedule_init();
 	adc_init();
 
 	// Start ADC loop by reading any channel
@@ -55,10 +68,28 @@ int main() {
 	sei();
 
 	while (true) {
+		// Serial messages go first. Tasks deferred by the
+		// interrupts and the periodic timer are run one at a
+		// time to check for new messages in between.
 		loop();
+		if (task_run()) continue;
 
-		// CPU sleeps until interrupts occur.
-		sleep_mode();
+		// CPU sleeps until interrupts occur. Interrupts are
+		// disabled while checking for tasks to not miss the
+		// wakeup. The instruction after sei() is always
+		// executed before any interrupt. The time asleep is
+		// measured for the load statistics.
+		cli();
+		if (!task_is_pending()) {
+			stats_mark_t const mark = stats_mark();
+			sleep_enable();
+			sei();
+			sleep_cpu();
+			sleep_disable();
+			cli();
+			stats_sleep_end(mark);
+		}
+		sei();
 	}
 }
 
@@ -79,8 +110,11 @@ void loop(void) {
 
 	const bool overflow = len > SERIAL_RX_LEN;
 	// Modbus function code is never an ASCII letter so it can be
-	// used to check if the message is textual.
-	const bool is_ascii = len >= 2 && isalpha(rx_buf[1]);
+	// used to check if the message is textual. The exception is
+	// the ASCII tunnel, which is a valid Modbus frame. The frame
+	// may be addressed to another server, so the ID isn't checked.
+	const bool is_ascii = len >= 2 && isalpha(rx_buf[1]) &&
+		!(WITH_MODBUS && modbus_crc_ok(rx_buf, len));
 	const bool ascii_allowed = WITH_ASCII && (!WITH_MODBUS || is_ascii);
 	
 	if (overflow) {
@@ -107,3 +141,19 @@ void loop(void) {
 		serial_free_message();
 	}
 }
+
+// Defer the periodic tasks from the timer interrupt. They go before
+// the measurement stores to keep the pace.
+static void post_periodic(void)
+{
+	task_post(TASK_HIGH, periodic, 0);
+}
+
+// Run tasks which are done once per second.
+static void periodic(uint16_t _)
+{
+	history_tick();
+	schedule_tick();
+	sram_tick();
+	stats_tick();
+}
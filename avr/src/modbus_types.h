@@ -8,6 +8,7 @@ typedef enum {
 	DISCRETE_INPUT = 'd',
 	INPUT_REGISTER = 'i',
 	HOLDING_REGISTER = 'h',
+	FILE_RECORD = 'f',
 } modbus_object_t;
 
 // The codes match Modbus exception responses.
@@ -0,0 +1,110 @@
+// Pumpunjuksautin asynchronous EEPROM writer.
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "persist.h"
+#include "sram.h"
+
+// Queue length. Must be a power of two.
+#define QUEUE_LEN 8
+#define QUEUE_MASK (QUEUE_LEN - 1)
+
+typedef struct {
+	uint8_t *ee;        // EEPROM destination
+	uint8_t const *ram; // SRAM source
+	uint8_t len;        // Length in bytes
+} job_t;
+
+// Accessed only inside ISR and atomic blocks
+static job_t queue[QUEUE_LEN];
+static uint8_t head = 0;            // Job being written
+static uint8_t pos = 0;             // Next byte of the head job
+static volatile uint8_t count = 0;  // Jobs in the queue
+
+void persist_update(void *const ee_dst, void const *const src, uint8_t const len)
+{
+	while (true) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			// The data is read from the source when written,
+			// so it's enough to have it in the queue once. If
+			// it's being written right now, start over to
+			// avoid storing a half-updated value.
+			for (uint8_t i = 0; i < count; i++) {
+				job_t const *j = queue + ((head + i) & QUEUE_MASK);
+				if (j->ee == ee_dst && j->ram == src && j->len == len) {
+					if (i == 0) pos = 0;
+					return;
+				}
+			}
+
+			if (count < QUEUE_LEN) {
+				job_t *j = queue + ((head + count) & QUEUE_MASK);
+				j->ee = ee_dst;
+				j->ram = src;
+				j->len = len;
+				count++;
+
+				// Interrupt fires when EEPROM is ready
+				EECR |= _BV(EERIE);
+				return;
+			}
+		}
+		// Queue is full. The interrupt makes space eventually.
+	}
+}
+
+bool persist_is_busy(void)
+{
+	return count != 0;
+}
+
+// Writes the next changed byte. Fires repeatedly as long as the
+// interrupt is enabled and no write is in progress.
+ISR(EE_READY_vect)
+{
+	sram_isr_leaf();
+
+	while (count) {
+		job_t const *j = queue + head;
+		uint8_t *const addr = j->ee + pos;
+		uint8_t const val = j->ram[pos];
+
+		// Advance to the next byte
+		if (++pos == j->len) {
+			pos = 0;
+			head = (head + 1) & QUEUE_MASK;
+			count--;
+		}
+
+		// Skip unchanged bytes
+		EEAR = (uint16_t)addr;
+		EECR |= _BV(EERE);
+		if (EEDR == val) continue;
+
+		// Erase and write. EEPE must be set within 4 cycles
+		// after EEMPE.
+		EEDR = val;
+		EECR |= _BV(EEMPE);
+		EECR |= _BV(EEPE);
+		return;
+	}
+
+	// All done
+	EECR &= ~_BV(EERIE);
+}
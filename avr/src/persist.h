@@ -0,0 +1,30 @@
+#pragma once
+
+/*
+  Asynchronous EEPROM writer
+
+  Writing a byte to EEPROM takes about 3.3 ms. Instead of waiting for
+  that in the command handlers, the writes are queued and performed
+  by EE_READY interrupt in the background. Only the bytes which
+  differ from the EEPROM contents are written.
+
+  The queue stores references, not the data. The source SRAM variable
+  is the authoritative copy of the value and it is read at the moment
+  of writing. Therefore the source must be a static variable which is
+  kept up to date. Updating the same variable again before the
+  previous write has finished doesn't take another queue slot.
+
+  Don't read EEPROM after enabling interrupts. Reading at
+  initialization is fine.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Queue writing len bytes from SRAM src to EEPROM address ee_dst. If
+// the queue is full, waits for a free slot. Must be called with
+// interrupts enabled, outside of ISRs.
+void persist_update(void *ee_dst, void const *src, uint8_t len);
+
+// Are there any pending writes?
+bool persist_is_busy(void);
@@ -9,6 +9,8 @@
 #define _TOGGLE(type,name,bit)       type ## name  ^= _BV(bit)
 #define _GET(type,name,bit)          ((type ## name >> bit) &  1)
 #define _PUT(type,name,bit,value)    type ## name = ( type ## name & ( ~ _BV(bit)) ) | ( ( 1 & (unsigned char)value ) << bit )
+#define _ADDR(type,name,bit)         (&type ## name)
+#define _MASK(type,name,bit)         _BV(bit)
 
 // These macros are used by end user.
 #define OUTPUT(pin)         _SET(DDR,pin)
@@ -18,3 +20,8 @@
 #define TOGGLE(pin)         _TOGGLE(PORT,pin)
 #define READ(pin)           _GET(PIN,pin)
 #define STATE(pin)          _GET(PORT,pin)
+
+// Register addresses and the bit mask, for keeping pins in tables.
+#define DDR_ADDR(pin)       _ADDR(DDR,pin)
+#define PORT_ADDR(pin)      _ADDR(PORT,pin)
+#define PIN_MASK(pin)       _MASK(DDR,pin)
@@ -0,0 +1,71 @@
+// Pumpunjuksautin time-of-day target schedule.
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <string.h>
+#include <avr/eeprom.h>
+#include "schedule.h"
+#include "juksautin.h"
+#include "clock.h"
+#include "persist.h"
+
+#define DAY (24*60*60l)
+#define SLOT_LEN (DAY / SCHEDULE_SLOTS)
+#define NO_SLOT 0xFF
+
+#if DAY % SCHEDULE_SLOTS != 0 || SCHEDULE_SLOTS >= NO_SLOT
+#error SCHEDULE_SLOTS must divide a day evenly
+#endif
+
+static uint16_t ee_schedule[SCHEDULE_SLOTS] EEMEM;
+static uint16_t schedule[SCHEDULE_SLOTS]; // SRAM copy of ee_schedule
+static uint8_t slot = NO_SLOT; // Currently applied slot
+
+void schedule_init(void)
+{
+	eeprom_read_block(schedule, ee_schedule, sizeof(schedule));
+}
+
+__attribute__((noinline, noclone))
+void schedule_tick(void)
+{
+	// Without real time the slots mean nothing.
+	if (!clock_is_set()) return;
+
+	uint32_t const local = clock_get_time_unix() + clock_get_gmtoff();
+	uint8_t const now = local % DAY / SLOT_LEN;
+	if (now == slot) return;
+	slot = now;
+
+	uint16_t const mv = schedule[slot];
+	if (mv == SCHEDULE_KEEP || mv == 0xFFFF) return;
+	juksautin_apply_target(0, mv);
+}
+
+void schedule_get(uint16_t *const out)
+{
+	memcpy(out, schedule, sizeof(schedule));
+}
+
+modbus_status_t schedule_set(uint16_t const *const in)
+{
+	memcpy(schedule, in, sizeof(schedule));
+	persist_update(ee_schedule, schedule, sizeof(schedule));
+
+	// Re-evaluate on the next tick
+	slot = NO_SLOT;
+	return MODBUS_OK;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+/*
+  Time-of-day target schedule
+
+  The day is divided to SCHEDULE_SLOTS slots of equal length in local
+  time. Each slot has a target voltage in millivolts which is applied
+  when the slot begins. Value 0 (and 0xFFFF in erased EEPROM) keeps
+  the target unchanged. The schedule is stored to EEPROM, the applied
+  target is not, so after a reset the stored target is used until the
+  clock is set.
+
+  Writing target manually overrides the schedule until the next slot
+  begins.
+*/
+
+#include <stdint.h>
+#include "modbus_types.h"
+
+// Number of slots per day. Must divide a day evenly. The whole table
+// must fit in a single Modbus write. Keep in sync with the array
+// length in commands.tsv.
+#define SCHEDULE_SLOTS 24
+
+// Target value which doesn't change the target.
+#define SCHEDULE_KEEP 0
+
+// Load the schedule from EEPROM.
+void schedule_init(void);
+
+// Call once per second. Applies the slot target when a slot begins.
+void schedule_tick(void);
+
+// Copy the schedule to out, SCHEDULE_SLOTS values.
+void schedule_get(uint16_t *out);
+
+// Store a new schedule of SCHEDULE_SLOTS values. The target of the
+// current slot is applied on the next schedule_tick().
+modbus_status_t schedule_set(uint16_t const *in);
@@ -30,6 +30,8 @@
 #include "clock.h"
 #include "pin.h"
 #include "hardware_config.h"
+#include "sram.h"
+#include "stats.h"
 
 typedef enum {
 	rx_active, // Receiving data
@@ -56,9 +58,21 @@ static volatile bool tx_state = false; // Is tx start requested
 // (Error) counters
 static volatile serial_counter_t counts = {0, 0, 0};
 
+// Line error counters. Written only in USART_RX_vect.
+static volatile struct {
+	uint16_t framing;
+	uint16_t overrun;
+	uint16_t parity;
+	uint16_t breaks;
+} line_errors;
+static bool in_break = false; // Was the previous byte part of a BREAK?
+
 // Static prototypes
 static void transmit_now(void);
 static void end_of_frame(void);
+static void silence_elapsed(void);
+static void line_error(uint8_t status, char in);
+static uint16_t get_atomic(volatile uint16_t *p);
 
 void serial_init(void)
 {
@@ -82,6 +96,9 @@ void serial_init(void)
 		_BV(RXCIE0) | // Enable USART_RX_vect
 		_BV(TXEN0)  | // Transmitter enable
 		_BV(TXCIE0);  // Enable USART_TX_vect
+
+	// Line silence is measured with the priority timer
+	clock_set_timer_handler(silence_elapsed);
 }
 
 bool serial_is_transmitting(void) {
@@ -137,11 +154,10 @@ void serial_tx_bin(buflen_t const len) {
 	if (rx_state == rx_tx_ready) transmit_now();
 }
 
-// Callback when clock_arm_timer triggered
-ISR(TIMER2_COMPB_vect) {
-	// Timer is oneshot, cancel timer
-	TIMSK2 &= ~_BV(OCIE2B);
-
+// Callback when clock_arm_timer triggered. Called from the timer
+// interrupt.
+static void silence_elapsed(void)
+{
 	if (rx_state == rx_active) {
 		// Phase 1: End of frame. Restart timer for phase 2.
 		rx_state = rx_end;
@@ -159,6 +175,10 @@ static void end_of_frame(void)
 {
 	bool const overflow = serial_rx_i > SERIAL_RX_LEN;
 	bool locked = serial_rx_front != NULL;
+	if (serial_rx_i == 0) {
+		// Nothing left after a line error. Not a frame.
+		goto rewind;
+	}
 	if (locked) {
 		// We need to throw a frame overboard
 		// because main loop didn't process
@@ -238,11 +258,42 @@ serial_counter_t pull_serial_counters(void) {
 	return ret;
 }
 
+uint16_t serial_get_framing_errors(void)
+{
+	return get_atomic(&line_errors.framing);
+}
+
+uint16_t serial_get_overruns(void)
+{
+	return get_atomic(&line_errors.overrun);
+}
+
+uint16_t serial_get_parity_errors(void)
+{
+	return get_atomic(&line_errors.parity);
+}
+
+uint16_t serial_get_breaks(void)
+{
+	return get_atomic(&line_errors.breaks);
+}
+
+static uint16_t get_atomic(volatile uint16_t *p)
+{
+	uint16_t v;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		v = *p;
+	}
+	return v;
+}
+
 // Transmit finished. This interrupt is called after all data has been
 // sent (UDRE_vect no longer feeds data). In this interrupt the RS-485
 // is switched back to receive mode.
-ISR(USART_TX_vect)
+STATS_ISR(USART_TX_vect, STATS_TX)
 {
+	sram_isr_leaf();
+
 	// Indicator only.
 	TOGGLE(PIN_LED);
 
@@ -257,8 +308,10 @@ ISR(USART_TX_vect)
 }
 
 // Called when there is opportunity to fill TX FIFO.
-ISR(USART_UDRE_vect)
+STATS_ISR(USART_UDRE_vect, STATS_UDRE)
 {
+	sram_isr_leaf();
+
 	char const out = serial_tx[serial_tx_i];
 
 	if (serial_tx_len == serial_tx_i + 1) {
@@ -273,16 +326,27 @@ ISR(USART_UDRE_vect)
 }
 
 // Called when data available from serial.
-ISR(USART_RX_vect)
+STATS_ISR(USART_RX_vect, STATS_RX)
 {
+	sram_isr_leaf();
+
 	// Arm the timer when we receive a character. When
 	// MODBUS_SILENCE amount of ticks is passed, consider a
 	// complete frame.
 	clock_arm_timer(MODBUS_SILENCE);
 	rx_state = rx_active;
 
+	// Status flags refer to the byte in UDR0, so they must be
+	// read first.
+	uint8_t const status = UCSR0A;
 	char in = UDR0;
 
+	if (status & (_BV(FE0) | _BV(DOR0) | _BV(UPE0))) {
+		line_error(status, in);
+		return;
+	}
+	in_break = false;
+
 	// Using >= in comparison instead of > because we got a
 	// character after the buffer is already full (no place to put
 	// that character any more).
@@ -297,3 +361,28 @@ ISR(USART_RX_vect)
 	serial_rx_back[serial_rx_i] = in;
 	serial_rx_i++;
 }
+
+// Called from USART_RX_vect when the received byte has an error
+// flag. The frame is already corrupt, so it's discarded right away
+// instead of waiting for the CRC check to fail. The bytes after the
+// error start a new frame. Sending a BREAK before a frame is therefore
+// a reliable way to resynchronize.
+static void line_error(uint8_t const status, char const in)
+{
+	if (status & _BV(DOR0)) line_errors.overrun++;
+	if (status & _BV(UPE0)) line_errors.parity++;
+	if (status & _BV(FE0)) {
+		// BREAK holds the line low over the stop bit, so it
+		// looks like a NUL byte with a framing error. Long
+		// BREAKs span several bytes but are counted once.
+		if (in != '\0') {
+			line_errors.framing++;
+		} else if (!in_break) {
+			line_errors.breaks++;
+			in_break = true;
+		}
+	}
+
+	// Rewind receive buffer. This also clears overflow.
+	serial_rx_i = 0;
+}
@@ -51,3 +51,10 @@ void serial_tx_bin(buflen_t const len);
 
 // Get serial counters and zero them
 serial_counter_t pull_serial_counters(void);
+
+// Line error counters. Received bytes with an error discard the frame
+// received so far. The counters wrap around and are never reset.
+uint16_t serial_get_framing_errors(void);
+uint16_t serial_get_overruns(void);
+uint16_t serial_get_parity_errors(void);
+uint16_t serial_get_breaks(void);
@@ -0,0 +1,73 @@
+// Pumpunjuksautin SRAM usage instrumentation.
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <avr/io.h>
+#include "sram.h"
+
+// Fill pattern of the unused SRAM. Unlikely to be a stack value.
+#define PAINT 0xC5
+
+// Section boundaries from the avr-libc linker script
+extern uint8_t __data_start, __data_end;
+extern uint8_t __bss_start, __bss_end;
+extern uint8_t _end;
+
+uint8_t sram_nesting = 0;
+uint8_t sram_nesting_max = 0;
+
+static uint16_t stack_free = 0;
+
+void sram_paint(void) __attribute__((naked, used, section(".init3")));
+
+// Paint from the end of .bss up to the stack pointer. Runs before
+// .data and .bss are initialized, with the stack still empty. Being
+// naked in an init section, the code falls through to the next
+// section instead of returning.
+void sram_paint(void)
+{
+	uint8_t *p = &_end;
+	while (p <= (uint8_t *)SP) *p++ = PAINT;
+}
+
+void sram_tick(void)
+{
+	// The deepest point reached is the first overwritten byte
+	// from below.
+	uint8_t const *p = &_end;
+	while (p < (uint8_t *)SP && *p == PAINT) p++;
+	stack_free = p - &_end;
+}
+
+uint16_t sram_get_stack_free(void)
+{
+	return stack_free;
+}
+
+uint16_t sram_get_data_size(void)
+{
+	return &__data_end - &__data_start;
+}
+
+uint16_t sram_get_bss_size(void)
+{
+	return &__bss_end - &__bss_start;
+}
+
+uint16_t sram_get_nesting_max(void)
+{
+	return sram_nesting_max;
+}
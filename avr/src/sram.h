@@ -0,0 +1,62 @@
+#pragma once
+
+/*
+  SRAM usage instrumentation
+
+  The free SRAM between the end of .bss and the stack is painted with
+  a fill pattern before main() starts. The stack grows down towards
+  .bss, so the lowest overwritten byte is the deepest point the stack
+  has ever reached. sram_tick() scans for it periodically.
+
+  Interrupt handlers report themselves with the functions below, so
+  the deepest nesting of interrupts is recorded. Nesting happens
+  because the ADC handler enables interrupts.
+*/
+
+#include <stdint.h>
+
+// Nesting depth of the handlers which enable interrupts, and the
+// maximum depth seen. Use the functions below instead.
+extern uint8_t sram_nesting;
+extern uint8_t sram_nesting_max;
+
+// Call at the start of interrupt handlers which keep interrupts
+// disabled.
+static inline void sram_isr_leaf(void)
+{
+	uint8_t const depth = sram_nesting + 1;
+	if (depth > sram_nesting_max) sram_nesting_max = depth;
+}
+
+// Call in interrupt handlers which enable interrupts, before enabling
+// them.
+static inline void sram_isr_enter(void)
+{
+	uint8_t const depth = ++sram_nesting;
+	if (depth > sram_nesting_max) sram_nesting_max = depth;
+}
+
+// Call at the end of the handlers which called sram_isr_enter(). The
+// decrement may be interrupted, but nested handlers leave the value
+// as they found it.
+static inline void sram_isr_exit(void)
+{
+	sram_nesting--;
+}
+
+// Scan for the stack high-water mark. Call periodically from the main
+// loop.
+void sram_tick(void);
+
+// Bytes of stack never used since reset.
+uint16_t sram_get_stack_free(void);
+
+// Size of initialized data in bytes.
+uint16_t sram_get_data_size(void);
+
+// Size of zero-initialized data in bytes.
+uint16_t sram_get_bss_size(void);
+
+// Deepest nesting of interrupt handlers since reset. 1 means no
+// nesting.
+uint16_t sram_get_nesting_max(void);
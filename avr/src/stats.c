@@ -0,0 +1,96 @@
+// Pumpunjuksautin runtime statistics.
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <util/atomic.h>
+#include "stats.h"
+#include "clock.h"
+
+#define TICKS_PER_SECOND CLOCK_MS(1000)
+
+stats_counter_t stats_isr[STATS_ISR_LEN];
+uint32_t stats_isr_cycles = 0;
+uint32_t stats_sleep_cycles = 0; // Updated only by the main loop
+
+static uint8_t reset_cause = 0;
+static uint32_t uptime = 0;
+static uint16_t load = 0;
+
+void stats_init(void)
+{
+	// MCUSR must be cleared or the flags accumulate over resets
+	reset_cause = MCUSR;
+	MCUSR = 0;
+
+	// TIMER1 in normal mode without prescaler
+	TCCR1A = 0;
+	TCCR1B = _BV(CS10);
+}
+
+void stats_tick(void)
+{
+	static uint32_t last_ticks = 0;
+	static uint32_t last_sleep = 0;
+	static uint32_t rest = 0; // Ticks of the unfinished second
+
+	// Ticks are monotonic unlike the time which may be set
+	uint32_t const now = clock_get_ticks();
+	uint32_t const elapsed = now - last_ticks;
+	last_ticks = now;
+
+	rest += elapsed;
+	while (rest >= TICKS_PER_SECOND) {
+		rest -= TICKS_PER_SECOND;
+		uptime++;
+	}
+
+	// Load is the share of the cycles not spent sleeping
+	uint32_t const per_mille = elapsed * CLOCK_PRESCALER / 1000;
+	uint32_t const slept = stats_sleep_cycles - last_sleep;
+	last_sleep = stats_sleep_cycles;
+	if (per_mille == 0) return;
+	uint32_t const sleep_share = slept / per_mille;
+	load = sleep_share >= 1000 ? 0 : 1000 - sleep_share;
+}
+
+uint32_t stats_get_uptime(void)
+{
+	return uptime;
+}
+
+uint16_t stats_get_reset_cause(void)
+{
+	return reset_cause;
+}
+
+uint16_t stats_get_load(void)
+{
+	return load;
+}
+
+void stats_get_isr(uint16_t *out)
+{
+	for (uint8_t i = 0; i < STATS_ISR_LEN; i++) {
+		stats_counter_t c;
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			c = stats_isr[i];
+		}
+		*out++ = c.count >> 16;
+		*out++ = c.count;
+		*out++ = c.cycles >> 16;
+		*out++ = c.cycles;
+	}
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+/*
+  Runtime statistics
+
+  TIMER1 runs freely at the CPU clock and serves as a cycle
+  counter. Interrupt handlers defined with STATS_ISR() count their
+  invocations and the cycles they take, excluding the cycles of the
+  handlers nested in them and the register saving done by the
+  compiler. The main loop counts the cycles spent sleeping. A single
+  measurement must be shorter than 65536 cycles (4 ms at 16 MHz),
+  which holds because the ADC interrupt fires every 104 µs.
+
+  The counters wrap around and are never reset. Read them twice and
+  compare to uptime to get the rates.
+*/
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+// Measured interrupt handlers, in the order of stats_get_isr()
+typedef enum {
+	STATS_ADC,
+	STATS_RX,
+	STATS_UDRE,
+	STATS_TX,
+	STATS_TIMER_A,
+	STATS_TIMER_B,
+	STATS_ISR_LEN,
+} stats_isr_t;
+
+typedef struct {
+	uint32_t count;  // Invocations
+	uint32_t cycles; // CPU cycles spent
+} stats_counter_t;
+
+// Start of a measurement
+typedef struct {
+	uint16_t start;  // TCNT1 at the start
+	uint32_t nested; // stats_isr_cycles at the start
+} stats_mark_t;
+
+// Counters of the handlers and the total cycles spent in them. Use
+// the functions below instead.
+extern stats_counter_t stats_isr[STATS_ISR_LEN];
+extern uint32_t stats_isr_cycles;
+extern uint32_t stats_sleep_cycles;
+
+// Start a measurement. Call with interrupts disabled.
+static inline stats_mark_t stats_mark(void)
+{
+	stats_mark_t const m = { TCNT1, stats_isr_cycles };
+	return m;
+}
+
+// Cycles since the mark, excluding the interrupt handlers run in
+// between. Call with interrupts disabled.
+static inline uint16_t stats_since(stats_mark_t const m)
+{
+	uint16_t const nested = stats_isr_cycles - m.nested;
+	return (uint16_t)(TCNT1 - m.start) - nested;
+}
+
+// End the measurement of an interrupt handler. The ADC handler ends
+// with interrupts enabled, so they are disabled here. The return
+// from interrupt enables them again.
+static inline void stats_isr_end(stats_isr_t const isr, stats_mark_t const m)
+{
+	cli();
+	uint16_t const own = stats_since(m);
+	stats_isr[isr].count++;
+	stats_isr[isr].cycles += own;
+	stats_isr_cycles += own;
+}
+
+// End the measurement of a sleep. Call with interrupts disabled.
+static inline void stats_sleep_end(stats_mark_t const m)
+{
+	stats_sleep_cycles += stats_since(m);
+}
+
+// Define an interrupt handler which is measured as the given
+// stats_isr_t. Use like ISR(vector).
+#define STATS_ISR(vector, isr)						\
+	static inline void vector##_body(void) __attribute__((always_inline)); \
+	ISR(vector)							\
+	{								\
+		stats_mark_t const mark = stats_mark();			\
+		vector##_body();					\
+		stats_isr_end(isr, mark);				\
+	}								\
+	static inline void vector##_body(void)
+
+// Start the cycle counter and store the reset cause. Call before
+// enabling interrupts.
+void stats_init(void);
+
+// Update uptime and load. Call from the main loop once per second.
+void stats_tick(void);
+
+// Seconds since reset.
+uint32_t stats_get_uptime(void);
+
+// Reset cause from MCUSR: bit 0 power-on, 1 external, 2 brown-out,
+// 3 watchdog.
+uint16_t stats_get_reset_cause(void);
+
+// Share of the previous second the CPU was awake in 1/1000 units.
+uint16_t stats_get_load(void);
+
+// Get the counters of the interrupt handlers in the order of
+// stats_isr_t. Every handler takes four registers: the count and
+// the cycles as 32-bit values, the most significant word first.
+void stats_get_isr(uint16_t *out);
@@ -0,0 +1,130 @@
+// Pumpunjuksautin wear-levelled settings storage.
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stddef.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include "store.h"
+#include "persist.h"
+
+// Number of record slots. Uses half of the EEPROM.
+#define SLOTS 50
+#define NO_SLOT 0xFF
+
+#if SLOTS <= STORE_KEYS || SLOTS >= NO_SLOT
+#error Invalid number of store slots
+#endif
+
+typedef struct {
+	uint8_t key;
+	uint32_t seq;
+	uint32_t value;
+	uint8_t crc;
+} record_t;
+
+static uint8_t crc(record_t const *r);
+static bool is_latest(uint8_t slot);
+static uint8_t next_slot(uint8_t slot);
+
+static record_t ee_store[SLOTS] EEMEM;
+
+static record_t latest[STORE_KEYS];   // SRAM copies of the latest records
+static uint8_t latest_slot[STORE_KEYS]; // Their positions in EEPROM
+static uint8_t head = 0;              // Where to write next
+static uint32_t seq = 0;              // Latest sequence number
+
+void store_init(void)
+{
+	for (uint8_t k = 0; k < STORE_KEYS; k++) {
+		latest_slot[k] = NO_SLOT;
+	}
+
+	uint8_t newest = NO_SLOT;
+	for (uint8_t slot = 0; slot < SLOTS; slot++) {
+		record_t r;
+		eeprom_read_block(&r, ee_store + slot, sizeof(r));
+
+		// Skip empty, unknown and broken records
+		if (r.key >= STORE_KEYS || r.crc != crc(&r)) continue;
+
+		// Keep only the latest record of each key
+		if (latest_slot[r.key] == NO_SLOT || r.seq > latest[r.key].seq) {
+			latest[r.key] = r;
+			latest_slot[r.key] = slot;
+		}
+		if (newest == NO_SLOT || r.seq > seq) {
+			seq = r.seq;
+			newest = slot;
+		}
+	}
+
+	// Continue after the latest write
+	if (newest != NO_SLOT) head = next_slot(newest);
+}
+
+bool store_get(store_key_t const key, uint32_t *const value)
+{
+	if (latest_slot[key] == NO_SLOT) return false;
+	*value = latest[key].value;
+	return true;
+}
+
+void store_set(store_key_t const key, uint32_t const value)
+{
+	record_t *const r = latest + key;
+	if (latest_slot[key] != NO_SLOT && r->value == value) return;
+
+	// Find a slot which doesn't hold the latest record of any key.
+	// There's always one because there are more slots than keys.
+	while (is_latest(head)) {
+		head = next_slot(head);
+	}
+
+	r->key = key;
+	r->seq = ++seq;
+	r->value = value;
+	r->crc = crc(r);
+	latest_slot[key] = head;
+	persist_update(ee_store + head, r, sizeof(*r));
+
+	head = next_slot(head);
+}
+
+// Calculate CRC of the record, excluding the CRC field.
+static uint8_t crc(record_t const *const r)
+{
+	uint8_t const *p = (uint8_t const *)r;
+	uint8_t c = 0xFF;
+	for (uint8_t i = 0; i < offsetof(record_t, crc); i++) {
+		c = _crc8_ccitt_update(c, p[i]);
+	}
+	return c;
+}
+
+// Is the slot in use by the latest record of some key?
+static bool is_latest(uint8_t const slot)
+{
+	for (uint8_t k = 0; k < STORE_KEYS; k++) {
+		if (latest_slot[k] == slot) return true;
+	}
+	return false;
+}
+
+static uint8_t next_slot(uint8_t const slot)
+{
+	return slot + 1 == SLOTS ? 0 : slot + 1;
+}
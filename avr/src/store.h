@@ -0,0 +1,49 @@
+#pragma once
+
+/*
+  Wear-levelled settings storage
+
+  Settings are stored to EEPROM as a log of records. Every change
+  writes a new record to the next free slot instead of overwriting
+  the previous one, so the writes are spread evenly over all the
+  slots. Record format:
+
+    key       1 byte   Setting, see store_key_t. 0xFF if empty.
+    seq       4 bytes  Sequence number, incremented on every write
+    value     4 bytes  Setting value
+    crc       1 byte   CRC-8 of the above, initial value 0xFF
+
+  At boot the record with the highest sequence number and a valid CRC
+  is selected for every key. Slots containing those are never
+  overwritten, so an interrupted write can lose only the value being
+  written.
+
+  The writes are done in the background, see persist.h.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Keys of the stored settings. Don't reorder, append only.
+typedef enum {
+	STORE_TARGET,      // Target voltage, raw ADC units
+	STORE_ZONE_NOW,    // Current UTC offset
+	STORE_TS_TURN,     // Next UTC offset change
+	STORE_ZONE_TURN,   // UTC offset after the change
+	STORE_CONFIG_HEADER, // Config version and CRC, see config.h
+	STORE_TRIM,        // Crystal trim
+	STORE_TARGET_K9,   // Target voltage of K9 line, raw ADC units
+	STORE_KEYS,        // Number of keys
+} store_key_t;
+
+// Scan EEPROM for the latest records. Call before enabling
+// interrupts and before using the other functions.
+void store_init(void);
+
+// Get the latest value of the key to value. Returns false and leaves
+// value untouched if the key has never been stored.
+bool store_get(store_key_t key, uint32_t *value);
+
+// Store a new value for the key. Nothing is written if the value is
+// unchanged.
+void store_set(store_key_t key, uint32_t value);
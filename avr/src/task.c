@@ -0,0 +1,86 @@
+// Pumpunjuksautin deferred work queue.
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <avr/io.h>
+#include <util/atomic.h>
+#include "task.h"
+
+// Queue length of each priority. Must be a power of two.
+#define QUEUE_LEN 16
+#define QUEUE_MASK (QUEUE_LEN - 1)
+
+typedef struct {
+	task_handler_t f;
+	uint16_t arg;
+} task_t;
+
+typedef struct {
+	task_t queue[QUEUE_LEN];
+	uint8_t head; // Next free slot, moved by producers
+	uint8_t tail; // Oldest task, moved by the consumer
+} ring_t;
+
+static volatile ring_t rings[TASK_PRIORITIES];
+
+bool task_post(task_priority_t const prio, task_handler_t const f, uint16_t const arg)
+{
+	volatile ring_t *const r = rings + prio;
+
+	// Producers may interrupt each other because ADC handlers run
+	// with interrupts enabled. Posting is kept atomic to make
+	// them behave like a single producer.
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		uint8_t const h = r->head;
+		if (((h - r->tail) & 0xFF) == QUEUE_LEN) {
+			// Full
+			return false;
+		}
+		volatile task_t *t = r->queue + (h & QUEUE_MASK);
+		t->f = f;
+		t->arg = arg;
+		// Publish only after the slot is filled
+		r->head = h + 1;
+	}
+	return true;
+}
+
+__attribute__((noinline, noclone))
+bool task_run(void)
+{
+	for (volatile ring_t *r = rings; r < rings + TASK_PRIORITIES; r++) {
+		uint8_t const t = r->tail;
+		if (t == r->head) continue;
+
+		// Copy before freeing the slot
+		volatile task_t const *slot = r->queue + (t & QUEUE_MASK);
+		task_handler_t const f = slot->f;
+		uint16_t const arg = slot->arg;
+		r->tail = t + 1;
+
+		f(arg);
+		return true;
+	}
+	return false;
+}
+
+bool task_is_pending(void)
+{
+	for (uint8_t i = 0; i < TASK_PRIORITIES; i++) {
+		if (rings[i].tail != rings[i].head) return true;
+	}
+	return false;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+/*
+  Deferred work queue
+
+  Interrupt handlers post tasks which don't need to be done right
+  away, and the main loop runs them later with interrupts enabled,
+  one at a time. Tasks of higher priority are run first and tasks of
+  the same priority in the order they were posted. Every task runs to
+  completion. Serial messages are processed between the tasks, so a
+  response never waits for more than one task.
+
+  Each priority has its own ring where only task_post() moves the
+  head and only task_run() moves the tail, so the main loop doesn't
+  need to disable interrupts when running tasks.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Function which does the deferred work.
+typedef void (*task_handler_t)(uint16_t arg);
+
+// Task priorities, the most urgent first.
+typedef enum {
+	TASK_HIGH, // Work which should be done on time
+	TASK_LOW,  // Work which may wait, like storing measurements
+	TASK_PRIORITIES
+} task_priority_t;
+
+// Post task f to be called with the given argument. Safe to call from
+// ISRs, also from the ones which have enabled interrupts. Returns
+// false if the queue of the priority is full and the task was
+// dropped.
+bool task_post(task_priority_t prio, task_handler_t f, uint16_t arg);
+
+// Run the oldest posted task of the highest priority. Returns false if
+// there was nothing to run. Call only from the main loop.
+bool task_run(void);
+
+// Are there any tasks waiting?
+bool task_is_pending(void);
@@ -0,0 +1,120 @@
+// K5 line oscilloscope readout from JuksOS devices
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// The sample format is documented in avr/src/juksautin.h.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <err.h>
+#include <errno.h>
+#include <modbus.h>
+#include "capture.h"
+#include "raw.h"
+
+// Addresses in avr/commands.tsv
+#define COIL_CAPTURE 2
+#define REG_CAPTURE_LEVEL 18
+#define REG_CAPTURE_LEN 19
+#define FILE_CAPTURE 1
+
+#define CAPTURE_DRIVE 0x8000
+#define CAPTURE_GAP   0x4000
+#define CAPTURE_VALUE 0x03ff
+
+// Raw value to millivolt conversion, as in avr/src/juksautin.c
+#define MV_MULT 275
+#define MV_DIV 256
+
+// Records per file read request. Fits in the device's TX buffer.
+#define CHUNK 32
+
+// Time between successive K5 conversions in microseconds. Other
+// channels take one conversion slot when the gap bit is set.
+#define SAMPLE_US 104
+
+// How long to wait for the trigger
+#define TRIGGER_TIMEOUT_S 10
+
+static uint16_t get16(uint8_t const *p);
+
+void capture_dump_modbus(modbus_t *ctx, uint16_t const level, FILE *out)
+{
+	uint16_t len;
+	if (modbus_read_input_registers(ctx, REG_CAPTURE_LEN, 1, &len) != 1 ||
+	    modbus_write_register(ctx, REG_CAPTURE_LEVEL, level) != 1 ||
+	    modbus_write_bit(ctx, COIL_CAPTURE, true) != 1)
+	{
+		errx(2, "Modbus write failed: %s", modbus_strerror(errno));
+	}
+
+	// Poll until the device has finished capturing
+	for (int i = 0; ; i++) {
+		uint8_t busy;
+		if (modbus_read_bits(ctx, COIL_CAPTURE, 1, &busy) != 1) {
+			errx(2, "Modbus read failed: %s", modbus_strerror(errno));
+		}
+		if (!busy) break;
+		if (i == TRIGGER_TIMEOUT_S * 10) {
+			modbus_write_bit(ctx, COIL_CAPTURE, false);
+			errx(3, "Capture was not triggered in %d seconds", TRIGGER_TIMEOUT_S);
+		}
+		usleep(100000);
+	}
+
+	fputs("sample,time_us,mv,drive\n", out);
+
+	uint32_t time_us = 0;
+	for (uint16_t record = 0; record < len; ) {
+		uint16_t const count = len - record < CHUNK ? len - record : CHUNK;
+		uint8_t const req[] = {
+			7,                         // Byte count
+			6,                         // Reference type
+			FILE_CAPTURE >> 8, FILE_CAPTURE,
+			record >> 8, record,
+			count >> 8, count,
+		};
+		uint8_t rsp[RAW_MAX_PAYLOAD];
+		int const rsp_len = raw_request(ctx, 0x14, req, sizeof(req), rsp);
+		if (rsp_len == -1) {
+			errx(2, "Modbus file read failed: %s", modbus_strerror(errno));
+		}
+		if (rsp_len != 3 + 2 * count || rsp[0] != rsp_len - 1 ||
+		    rsp[1] != 1 + 2 * count || rsp[2] != 6)
+		{
+			errx(2, "Invalid file record response");
+		}
+
+		for (uint16_t i = 0; i < count; i++, record++) {
+			uint16_t const s = get16(rsp + 3 + 2*i);
+			if (record > 0) {
+				time_us += s & CAPTURE_GAP ? 2 * SAMPLE_US : SAMPLE_US;
+			}
+			uint16_t const mv = ((s & CAPTURE_VALUE) * MV_MULT + MV_DIV / 2) / MV_DIV;
+			fprintf(out, "%" PRIu16 ",%" PRIu32 ",%" PRIu16 ",%d\n",
+				record, time_us, mv, !!(s & CAPTURE_DRIVE));
+		}
+	}
+}
+
+// Reads big-endian 16-bit value
+static uint16_t get16(uint8_t const *p)
+{
+	return p[0] << 8 | p[1];
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <modbus.h>
+
+// Triggers a K5 capture (oscilloscope mode) with the given trigger
+// level in millivolts, waits for it to finish and outputs the samples
+// as CSV. Terminates the program in case of an error.
+void capture_dump_modbus(modbus_t *ctx, uint16_t level, FILE *out);
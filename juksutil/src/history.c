@@ -0,0 +1,125 @@
+// Measurement history readout from JuksOS devices
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// The format is documented in avr/src/history.h.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <err.h>
+#include <errno.h>
+#include <modbus.h>
+#include "history.h"
+#include "raw.h"
+
+#define FIELDS 6
+#define TIME_BIT 0x40
+#define PAD 0xff
+
+// Register address of history_oldest in avr/commands.tsv. It is
+// followed by history_count and history_interval.
+#define REG_HISTORY 15
+
+typedef struct {
+	uint16_t seq;
+	uint32_t time;
+	uint16_t value[FIELDS];
+} sample_t;
+
+static void print_sample(FILE *out, sample_t const *s);
+static uint16_t get16(uint8_t const *p);
+
+void history_dump_modbus(modbus_t *ctx, FILE *out)
+{
+	uint16_t regs[3];
+	if (modbus_read_input_registers(ctx, REG_HISTORY, 3, regs) != 3) {
+		errx(2, "Modbus read failed: %s", modbus_strerror(errno));
+	}
+	uint16_t seq = regs[0];
+	uint16_t const interval = regs[2];
+
+	fputs("seq,time,k5_raw,ratio,accu,out,error,target\n", out);
+
+	while (true) {
+		uint8_t const req[] = { seq >> 8, seq };
+		uint8_t rsp[RAW_MAX_PAYLOAD];
+		int const len = raw_request(ctx, 0x18, req, sizeof(req), rsp);
+		if (len == -1) {
+			errx(2, "Modbus FIFO read failed: %s", modbus_strerror(errno));
+		}
+		if (len < 4 || get16(rsp) != len - 2) {
+			errx(2, "Invalid FIFO response");
+		}
+
+		int const bytes = 2 * get16(rsp+2);
+		uint8_t const *p = rsp + 4;
+		uint8_t const *const end = p + bytes;
+		if (bytes == 0) break;
+		if (bytes < 2 * (3 + FIELDS) || end > rsp + len) {
+			errx(2, "Invalid history data");
+		}
+
+		// Keyframe
+		sample_t s;
+		s.seq = get16(p);
+		s.time = (uint32_t)get16(p+2) << 16 | get16(p+4);
+		p += 6;
+		for (int i = 0; i < FIELDS; i++, p += 2) {
+			s.value[i] = get16(p);
+		}
+		print_sample(out, &s);
+
+		// Delta records
+		while (p < end && *p != PAD) {
+			uint8_t const header = *p++;
+			if (header & TIME_BIT) {
+				s.time += (int32_t)((uint32_t)get16(p) << 16 | get16(p+2));
+				p += 4;
+			} else {
+				s.time += interval;
+			}
+			for (int i = 0; i < FIELDS; i++) {
+				int16_t d = (int8_t)*p++;
+				if (header & (1 << i)) {
+					d = (uint16_t)d << 8 | *p++;
+				}
+				s.value[i] += d;
+			}
+			s.seq++;
+			if (p > end) errx(2, "Truncated history record");
+			print_sample(out, &s);
+		}
+
+		seq = s.seq + 1;
+	}
+}
+
+static void print_sample(FILE *out, sample_t const *s)
+{
+	fprintf(out, "%" PRIu16 ",%" PRIu32, s->seq, s->time);
+	for (int i = 0; i < FIELDS; i++) {
+		fprintf(out, ",%" PRIu16, s->value[i]);
+	}
+	fputc('\n', out);
+}
+
+// Reads big-endian 16-bit value
+static uint16_t get16(uint8_t const *p)
+{
+	return p[0] << 8 | p[1];
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdio.h>
+#include <modbus.h>
+
+// Reads the measurement history from the device and outputs it as
+// CSV. Terminates the program in case of an error.
+void history_dump_modbus(modbus_t *ctx, FILE *out);
@@ -28,6 +28,9 @@
 #include "tz.h"
 #include "sync_clock.h"
 #include "serial.h"
+#include "history.h"
+#include "capture.h"
+#include "raw.h"
 
 static time_t get_timestamp(void);
 static tzinfo_t get_tzinfo(void);
@@ -36,9 +39,13 @@ static char *format_localtime(time_t ref, int32_t gmtoff, char *fmt);
 static void cmd_show_transition(void);
 static void cmd_sync_clock_modbus();
 static void cmd_sync_clock_ascii();
+static void cmd_calibrate(void);
 static void cmd_get_time_modbus();
 static void cmd_get_time_ascii();
 static void cmd_ascii(int const argc, char **argv);
+static void cmd_ascii_modbus(char const *line);
+static void cmd_history(void);
+static void cmd_capture(void);
 static bool matches(char const *const arg, char const *command, bool const cond);
 static void serial_timeout(int signo);
 static modbus_t *main_modbus_init(void);
@@ -51,6 +58,7 @@ static gchar *dev_path = NULL;
 static gint dev_baud = 9600;
 static gint dev_slave = 0;
 static gboolean break_first = false;
+static gint capture_level = 0;
 
 static GOptionEntry entries[] =
 {
@@ -60,6 +68,7 @@ static GOptionEntry entries[] =
 	{ "baud", 'b', 0, G_OPTION_ARG_INT, &dev_baud, "Device baud rate. Default: 9600", "BAUD"},
 	{ "slave", 's', 0, G_OPTION_ARG_INT, &dev_slave, "Device Modbus server id. If not defined, ASCII protocol is used", "ID"},
 	{ "break", 'B', 0, G_OPTION_ARG_NONE, &break_first, "Send BREAK before the command. Default: no break", NULL},
+	{ "level", 'l', 0, G_OPTION_ARG_INT, &capture_level, "Capture trigger level in millivolts. Default: 0 (trigger immediately)", "MV"},
 	{ NULL }
 };
 
@@ -74,7 +83,11 @@ int main(int argc, char **argv)
 					 "  show-transition       Show current time zone and future DST transition, if any.\n"
 					 "  get-time              Get current time from the device.\n"
 					 "  sync-time             Synchronize clock of JuksOS device. Sets also DST transition table.\n"
-					 "  send KEY[=VALUE]..    Read and/or write values from/to the hardware via ASCII interface\n"
+					 "  calibrate             Correct clock drift since the previous calibration. Modbus only.\n"
+					 "  send KEY[=VALUE]..    Read and/or write values from/to the hardware via ASCII interface.\n"
+					 "                        With Modbus, the commands are tunnelled inside Modbus frames.\n"
+					 "  history               Dump measurement history as CSV. Modbus only.\n"
+					 "  capture               Capture K5 line waveform as CSV. Modbus only.\n"
 					 "\n"
 					 "For more information about accepted timestamp formats, run: info coreutils date input\n"
 					 "To get list of all time zones known by your system, run: timedatectl list-timezones\n"
@@ -109,6 +122,8 @@ int main(int argc, char **argv)
 		} else {
 			cmd_sync_clock_ascii();
 		}
+	} else if (matches(argv[1], "calibrate", argc == 2)) {
+		cmd_calibrate();
 	} else if (matches(argv[1], "get-time", argc == 2)) {
 		if (dev_slave) {
 			cmd_get_time_modbus();
@@ -117,6 +132,10 @@ int main(int argc, char **argv)
 		}
 	} else if (matches(argv[1], "send", argc > 2)) {
 		cmd_ascii(argc-2, argv+2);
+	} else if (matches(argv[1], "history", argc == 2)) {
+		cmd_history();
+	} else if (matches(argv[1], "capture", argc == 2)) {
+		cmd_capture();
 	} else {
 		errx(1, "Invalid command name. See %s --help", argv[0]);
 	}
@@ -132,16 +151,17 @@ static bool matches(char const *const arg, char const *command, bool const cond)
 
 static void cmd_ascii(int const cmds, char **cmd)
 {
-	if (dev_slave) {
-		errx(1, "ASCII interface not available using Modbus. Don't use -s.");
-	}
-	
 	// Craft compound message
 	g_autoptr(GString) line_in = g_string_new(cmd[0]);
 	for (int i=1; i<cmds; i++) {
 		g_string_append_c(line_in, ' ');
 		g_string_append(line_in, cmd[i]);
 	}
+
+	if (dev_slave) {
+		cmd_ascii_modbus(line_in->str);
+		return;
+	}
 	g_string_append_c(line_in, '\n');
 
 	// Do the serial operations with a timeout
@@ -172,6 +192,50 @@ static void cmd_ascii(int const cmds, char **cmd)
 	fclose(f);
 }
 
+// Send ASCII commands tunnelled inside Modbus frames. Help output
+// is paged by the device, so it is collected in multiple requests.
+static void cmd_ascii_modbus(char const *line)
+{
+	modbus_t *ctx = main_modbus_init();
+	bool const help = strcasecmp(line, "help") == 0;
+	int next = 0;
+
+	do {
+		g_autoptr(GString) req = g_string_new(line);
+		if (help) g_string_printf(req, "help %d", next);
+
+		uint8_t rsp[RAW_MAX_PAYLOAD+1];
+		int const len = raw_request(ctx, 0x41, (uint8_t*)req->str, req->len, rsp);
+		if (len == -1) {
+			errx(2, "Modbus ASCII tunnel failed: %s", modbus_strerror(errno));
+		}
+		rsp[len] = '\0';
+		char *out = (char*)rsp;
+
+		if (!help) {
+			if (out[0] == ' ') {
+				// Put the command as a reference for
+				// the error message.
+				puts(line);
+			}
+			puts(out);
+			break;
+		}
+
+		// Paged help: "name(RW) name(R) ... +next"
+		next = 0;
+		for (char *item; (item = strsep(&out, " ")) != NULL; ) {
+			if (item[0] == '+') {
+				next = atoi(item+1);
+			} else if (item[0] != '\0') {
+				puts(item);
+			}
+		}
+	} while (next);
+
+	main_modbus_free(ctx);
+}
+
 static void serial_timeout(int signo) {
 	errx(1, "ASCII serial protocol timeout. Is the device on and is the baud rate correct?");
 }
@@ -195,6 +259,33 @@ static void cmd_get_time_modbus()
 	main_modbus_free(ctx);
 }
 
+// Command for dumping measurement history
+static void cmd_history()
+{
+	if (!dev_slave) {
+		errx(1, "History is available only via Modbus. Use -s.");
+	}
+
+	modbus_t *ctx = main_modbus_init();
+	history_dump_modbus(ctx, stdout);
+	main_modbus_free(ctx);
+}
+
+// Command for capturing K5 waveform
+static void cmd_capture()
+{
+	if (!dev_slave) {
+		errx(1, "Capture is available only via Modbus. Use -s.");
+	}
+	if (capture_level < 0 || capture_level > UINT16_MAX) {
+		errx(1, "Invalid capture level");
+	}
+
+	modbus_t *ctx = main_modbus_init();
+	capture_dump_modbus(ctx, capture_level, stdout);
+	main_modbus_free(ctx);
+}
+
 // Command for syncing the clock time of a device.
 static void cmd_sync_clock_modbus()
 {
@@ -217,6 +308,25 @@ static void cmd_sync_clock_ascii()
 	fclose(f);
 }
 
+// Command for calibrating the crystal of a device. The time of
+// calibration is kept in the user's cache directory, separately for
+// every device and server id.
+static void cmd_calibrate(void)
+{
+	if (!dev_slave) {
+		errx(1, "Calibration is available only via Modbus. Use -s.");
+	}
+
+	modbus_t *ctx = main_modbus_init();
+
+	g_autofree gchar *dev_name = g_path_get_basename(dev_path);
+	g_autofree gchar *file = g_strdup_printf("juksutil-calibration-%s-%d", dev_name, dev_slave);
+	g_autofree gchar *state_path = g_build_filename(g_get_user_cache_dir(), file, NULL);
+	sync_clock_calibrate_modbus(ctx, state_path);
+
+	main_modbus_free(ctx);
+}
+
 // Command for just showing the next DST transition and the UTC offset
 // before and after the transition.
 static void cmd_show_transition()
@@ -233,6 +343,13 @@ static void cmd_show_transition()
 		printf("\x1b[1mNext transition:\x1b[0m  %-21s%-27s%11ld%+8d\n", format_iso8601(info.transition), format_localtime(info.transition, info.gmtoff_after, "%F %T  %z"), info.transition, info.gmtoff_after);
 		printf("\nThat is, on %s,", format_localtime(info.transition, info.gmtoff_now, "%B %d when the time gets %H:%M"));
 		printf(" the hands are moved to %s.\n", format_localtime(info.transition, info.gmtoff_after, "%H:%M"));
+		if (info.table_len > 1) {
+			printf("\nFurther transitions:\n");
+			for (int i = 1; i < info.table_len; i++) {
+				tz_transition_t const *t = info.table + i;
+				printf("                  %-21s%-27s%11ld%+8d\n", format_iso8601(t->ts), format_localtime(t->ts, t->gmtoff, "%F %T  %z"), t->ts, t->gmtoff);
+			}
+		}
 	} else {
 		printf("\x1b[1mNext transition:\x1b[0m  No future transitions\n");
 	}
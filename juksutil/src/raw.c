@@ -0,0 +1,122 @@
+// Modbus transactions with non-standard function codes
+// SPDX-License-Identifier:   GPL-3.0-or-later
+// Copyright (C) 2021 Joel Lehtonen
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// libmodbus is able to send any request with
+// modbus_send_raw_request() but it is unable to receive responses
+// which have unknown length fields. Therefore we read the response
+// from the file descriptor ourselves and detect the end of frame by
+// silence on the line.
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <modbus.h>
+#include "raw.h"
+
+// Maximum time to wait for the response to start, in microseconds.
+static long const response_timeout = 1000000;
+
+// Silence after which the frame is considered complete. Way longer
+// than Modbus requires, because USB serial adapters buffer the data.
+static long const frame_timeout = 50000;
+
+static int read_frame(int fd, uint8_t *buf, int len);
+static uint16_t crc16(uint8_t const *buf, int len);
+
+int raw_request(modbus_t *ctx, uint8_t function, uint8_t const *req, int req_len, uint8_t *rsp)
+{
+	int const slave = modbus_get_slave(ctx);
+	uint8_t frame[MODBUS_RTU_MAX_ADU_LENGTH];
+
+	if (req_len + 2 > MODBUS_MAX_PDU_LENGTH) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	frame[0] = slave;
+	frame[1] = function;
+	memcpy(frame+2, req, req_len);
+	if (modbus_send_raw_request(ctx, frame, req_len+2) == -1) {
+		return -1;
+	}
+
+	int const len = read_frame(modbus_get_socket(ctx), frame, sizeof(frame));
+	if (len == -1) return -1;
+
+	// Validate the frame. CRC is little-endian on wire.
+	if (len < 5 || frame[0] != slave) {
+		errno = EMBBADDATA;
+		return -1;
+	}
+	if (crc16(frame, len-2) != (frame[len-2] | frame[len-1] << 8)) {
+		errno = EMBBADCRC;
+		return -1;
+	}
+	if (frame[1] == (function | 0x80)) {
+		// Exception response
+		errno = MODBUS_ENOBASE + frame[2];
+		return -1;
+	}
+	if (frame[1] != function) {
+		errno = EMBBADDATA;
+		return -1;
+	}
+
+	memcpy(rsp, frame+2, len-4);
+	return len-4;
+}
+
+// Reads until the line is silent long enough. Returns frame length or
+// -1 in case of an error.
+static int read_frame(int fd, uint8_t *buf, int len)
+{
+	int got = 0;
+	while (got < len) {
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(fd, &fds);
+		struct timeval tv = { 0, got ? frame_timeout : response_timeout };
+
+		int const ready = select(fd+1, &fds, NULL, NULL, &tv);
+		if (ready == -1) return -1;
+		if (ready == 0) {
+			if (got) break;
+			errno = ETIMEDOUT;
+			return -1;
+		}
+
+		ssize_t const n = read(fd, buf+got, len-got);
+		if (n == -1) return -1;
+		got += n;
+	}
+	return got;
+}
+
+// Modbus CRC-16
+static uint16_t crc16(uint8_t const *buf, int len)
+{
+	uint16_t crc = 0xffff;
+	for (int i = 0; i < len; i++) {
+		crc ^= buf[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+		}
+	}
+	return crc;
+}
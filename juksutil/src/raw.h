@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+#include <modbus.h>
+
+// Maximum length of a response payload returned by raw_request().
+#define RAW_MAX_PAYLOAD (MODBUS_RTU_MAX_ADU_LENGTH - 4)
+
+// Performs a Modbus transaction with a function code libmodbus
+// doesn't know how to receive. Parameter req contains the request
+// payload after the function code. Response payload after the
+// function code is stored to rsp which must be RAW_MAX_PAYLOAD bytes
+// long. Returns the payload length or -1 in case of an error, and
+// sets errno. Modbus exceptions are reported like libmodbus does, so
+// modbus_strerror() works.
+int raw_request(modbus_t *ctx, uint8_t function, uint8_t const *req, int req_len, uint8_t *rsp);
@@ -28,7 +28,33 @@
 #include <glib.h>
 #include "tz.h"
 
+// Holding registers of the time with sub-second precision: UNIX
+// timestamp followed by the fraction of second in 1/65536 s units.
+#define EXACT_TIME_ADDR 64
+#define FRAC_SCALE 65536.0
+
+// Holding registers of the DST table. Each entry has a UNIX timestamp
+// in two registers and the UTC offset after it in minutes.
+#define DST_TABLE_ADDR 68
+#define DST_TABLE_REGS (3 * TZ_TABLE_LEN)
+
+// Holding register of the crystal trim in 0.01 ppm units
+#define TRIM_ADDR 9
+
+// Shortest time between calibrations to get a meaningful result
+#define CALIBRATION_MIN_TIME 3600
+
+// Measurement and correction rounds and the accepted clock offset in
+// seconds.
+#define SYNC_ROUNDS 5
+#define SYNC_TOLERANCE 0.002
+
 static time_t exact_timestamp();
+static double host_time(void);
+static double measure_offset(modbus_t *ctx, double *rtt);
+static void write_exact(modbus_t *ctx, double t);
+static void sync_exact_modbus(modbus_t *ctx);
+static void write_dst_table(modbus_t *ctx, tzinfo_t const *tz);
 
 void sync_clock_get_time_modbus(GString *s, modbus_t *ctx)
 {
@@ -57,15 +83,157 @@ void sync_clock_modbus(tzinfo_t const *tz, bool real_time, modbus_t *ctx)
 	MODBUS_SET_INT32_TO_INT16(buf, 4, tz->transition);
 	MODBUS_SET_INT32_TO_INT16(buf, 6, tz->gmtoff_after);
 
-	// Sleep until next second and swap endianness of the timestamp
-	uint32_t now = real_time ? exact_timestamp() : tz->ref_time;
-	MODBUS_SET_INT32_TO_INT16(buf, 0, now);
+	write_dst_table(ctx, tz);
+
+	if (real_time) {
+		// Time zone first, then the time precisely
+		if (modbus_write_registers(ctx, 2, 6, buf+2) != 6) {
+			errx(2, "Modbus write failed: %s", modbus_strerror(errno));
+		}
+		sync_exact_modbus(ctx);
+		return;
+	}
+
+	// Swap endianness of the reference timestamp
+	MODBUS_SET_INT32_TO_INT16(buf, 0, tz->ref_time);
 
 	if (modbus_write_registers(ctx, 0, 8, buf) != 8) {
 		errx(2, "Modbus write failed: %s", modbus_strerror(errno));
 	}
 }
 
+void sync_clock_calibrate_modbus(modbus_t *ctx, char const *state_path)
+{
+	double rtt;
+	double const offset = measure_offset(ctx, &rtt);
+	double const now = host_time();
+
+	// Time of the previous calibration
+	double since;
+	FILE *f = fopen(state_path, "r");
+	bool const have_ref = f != NULL && fscanf(f, "%lf", &since) == 1;
+	if (f != NULL) fclose(f);
+
+	if (!have_ref) {
+		printf("No earlier calibration. Synchronizing the clock, run again after a few hours.\n");
+	} else {
+		double const elapsed = now - since;
+		if (elapsed < CALIBRATION_MIN_TIME) {
+			errx(1, "Only %.0f minutes since the previous calibration. Wait at least %d minutes.", elapsed / 60, CALIBRATION_MIN_TIME / 60);
+		}
+
+		uint16_t trim;
+		if (modbus_read_registers(ctx, TRIM_ADDR, 1, &trim) != 1) {
+			errx(2, "Modbus read failed: %s", modbus_strerror(errno));
+		}
+
+		// The clock was synchronized at the previous
+		// calibration, so the offset is the drift with the
+		// current trim.
+		double const ppm = offset / elapsed * 1e6;
+		double new_trim = (int16_t)trim + ppm * 100;
+		if (new_trim > INT16_MAX) new_trim = INT16_MAX;
+		if (new_trim < INT16_MIN) new_trim = INT16_MIN;
+		uint16_t const out = (int16_t)(new_trim + (new_trim < 0 ? -0.5 : 0.5));
+
+		if (modbus_write_register(ctx, TRIM_ADDR, out) != 1) {
+			errx(2, "Modbus write failed: %s", modbus_strerror(errno));
+		}
+		printf("Clock drifted %+.3f s in %.1f hours (%+.2f ppm). Trim changed from %+.2f to %+.2f ppm.\n",
+		       offset, elapsed / 3600, ppm, (int16_t)trim / 100.0, (int16_t)out / 100.0);
+	}
+
+	sync_exact_modbus(ctx);
+
+	f = fopen(state_path, "w");
+	if (f == NULL || fprintf(f, "%.3f\n", host_time()) < 0 || fclose(f)) {
+		err(1, "Unable to store calibration time to %s", state_path);
+	}
+}
+
+// Uploads the future transitions in a single write. Unused entries
+// are zeroed.
+static void write_dst_table(modbus_t *ctx, tzinfo_t const *tz)
+{
+	uint16_t buf[DST_TABLE_REGS] = {0};
+	for (int i = 0; i < tz->table_len; i++) {
+		MODBUS_SET_INT32_TO_INT16(buf, 3*i, tz->table[i].ts);
+		buf[3*i+2] = tz->table[i].gmtoff / 60;
+	}
+	if (modbus_write_registers(ctx, DST_TABLE_ADDR, DST_TABLE_REGS, buf) != DST_TABLE_REGS) {
+		errx(2, "Modbus write failed: %s", modbus_strerror(errno));
+	}
+}
+
+// Synchronizes the device clock to the host clock like NTP does. The
+// device time is read and compared to the midpoint of the round
+// trip. If the offset is too large, the time is written, estimating
+// it takes half of the round trip to land. The error of that estimate
+// is seen in the next round and compensated.
+static void sync_exact_modbus(modbus_t *ctx)
+{
+	double bias = 0;
+	bool written = false;
+	for (int round = 0; ; round++) {
+		double rtt;
+		double const offset = measure_offset(ctx, &rtt);
+		if (offset > -SYNC_TOLERANCE && offset < SYNC_TOLERANCE) {
+			return;
+		}
+		if (round == SYNC_ROUNDS) {
+			errx(2, "Clock offset is still %+.3f s after %d rounds", offset, SYNC_ROUNDS);
+		}
+
+		// The offset after a write is the error of our
+		// latency estimate.
+		if (written) bias -= offset;
+		write_exact(ctx, host_time() + rtt / 2 + bias);
+		written = true;
+	}
+}
+
+// Gets the offset of device clock to host clock in seconds. Round
+// trip time is stored to rtt.
+static double measure_offset(modbus_t *ctx, double *rtt)
+{
+	uint16_t in[3];
+	double const t0 = host_time();
+	if (modbus_read_registers(ctx, EXACT_TIME_ADDR, 3, in) != 3) {
+		errx(2, "Modbus read failed: %s", modbus_strerror(errno));
+	}
+	double const t1 = host_time();
+
+	double const device = (uint32_t)MODBUS_GET_INT32_FROM_INT16(in, 0) + in[2] / FRAC_SCALE;
+	*rtt = t1 - t0;
+	return device - (t0 + t1) / 2;
+}
+
+// Sets the device clock to t seconds since UNIX epoch.
+static void write_exact(modbus_t *ctx, double t)
+{
+	uint32_t secs = t;
+	uint32_t frac = (t - secs) * FRAC_SCALE + 0.5;
+	if (frac == FRAC_SCALE) {
+		secs++;
+		frac = 0;
+	}
+
+	uint16_t out[3];
+	MODBUS_SET_INT32_TO_INT16(out, 0, secs);
+	out[2] = frac;
+	if (modbus_write_registers(ctx, EXACT_TIME_ADDR, 3, out) != 3) {
+		errx(2, "Modbus write failed: %s", modbus_strerror(errno));
+	}
+}
+
+// Gets the host time in seconds since UNIX epoch.
+static double host_time(void)
+{
+	struct timespec tp;
+	if (clock_gettime(CLOCK_REALTIME, &tp)) err(1, "Time retrieval failed");
+	return tp.tv_sec + tp.tv_nsec / 1e9;
+}
+
 void sync_clock_ascii(tzinfo_t const *tz, bool real_time, FILE *f)
 {
 	// Sleep until next second if real time used
@@ -10,6 +10,11 @@ void sync_clock_get_time_modbus(GString *s, modbus_t *ctx);
 // time or use supplied reference time.
 void sync_clock_modbus(tzinfo_t const *tz, bool real_time, modbus_t *ctx);
 
+// Estimates crystal trim of a device from the clock drift since the
+// previous calibration and corrects it. Then synchronizes the clock
+// and stores the time of calibration to state_path.
+void sync_clock_calibrate_modbus(modbus_t *ctx, char const *state_path);
+
 // Synchronizes clock time of a device using the ASCII
 // protocol. Parameter real_time indicates if we synchronize current
 // time or use supplied reference time.
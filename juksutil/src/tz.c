@@ -17,6 +17,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+#include <time.h>
 #include <glib.h>
 #include <endian.h>
 #include "mmap.h"
@@ -28,6 +31,35 @@ static bool mmap_zonefile(char const *zone, mmap_info_t *file);
 static void *find_v2_header(char *p, int len);
 static bool find_next_transition(tzinfo_t *dest, char *p, int len, int64_t now);
 
+// Rule of POSIX TZ string, see tzset(3)
+typedef struct {
+	char type;    // 'J' (1-365, no leap day), 'n' (0-365) or 'M'
+	int day;      // Day for J and n, day of week for M
+	int month;    // Month for M
+	int week;     // Week for M, 5 meaning the last
+	int32_t time; // Local time of the change in seconds
+} tz_rule_t;
+
+typedef struct {
+	int32_t std_gmtoff; // Standard time UTC offset
+	int32_t dst_gmtoff; // Summer time UTC offset
+	bool has_dst;       // Are there summer time rules?
+	tz_rule_t start;    // Change to summer time
+	tz_rule_t end;      // Change to standard time
+} posix_tz_t;
+
+static bool parse_posix_tz(char const *p, char const *end, posix_tz_t *tz);
+static char const *parse_name(char const *p, char const *end);
+static char const *parse_offset(char const *p, char const *end, int32_t *out);
+static char const *parse_rule(char const *p, char const *end, tz_rule_t *rule);
+static int rule_transitions(posix_tz_t const *tz, int year, tz_transition_t *out);
+static int64_t rule_to_utc(tz_rule_t const *rule, int year, int32_t gmtoff);
+static int32_t posix_gmtoff_at(posix_tz_t const *tz, int64_t ts);
+static int64_t days_from_civil(int year, int month, int day);
+static bool is_leap(int year);
+static int year_of(int64_t ts);
+static void table_add(tzinfo_t *dest, int64_t ts, int32_t gmtoff);
+
 static int const header_len = 0x2c;
 static int const header_boilerplate = 0x14;
 static char const zone_dir[] = "/usr/share/zoneinfo/";
@@ -114,7 +146,7 @@ static void *find_v2_header(char *p, int len)
 	return p + skip;
 }
 
-// Find the next transition from version 2 part of the tzfile.
+// Find the next transitions from version 2 part of the tzfile.
 static bool find_next_transition(tzinfo_t *dest, char *p, int len, int64_t now)
 {
 	// Check if it's too short
@@ -126,48 +158,315 @@ static bool find_next_transition(tzinfo_t *dest, char *p, int len, int64_t now)
 	// Find boilerplate
 	uint32_t *lens = (uint32_t*)(p + header_boilerplate);
 
-	// Getting only the parts we are interested in.
+	// Using the obscure variable names from tzfile(5)
+	uint32_t tzh_ttisgmtcnt = be32toh(lens[0]);
+	uint32_t tzh_ttisstdcnt = be32toh(lens[1]);
+	uint32_t tzh_leapcnt    = be32toh(lens[2]);
 	uint32_t tzh_timecnt    = be32toh(lens[3]);
 	uint32_t tzh_typecnt    = be32toh(lens[4]);
+	uint32_t tzh_charcnt    = be32toh(lens[5]);
 
 	int64_t *transition = (void *)(p + header_len);
 	uint8_t *type = (void *)(transition + tzh_timecnt);
 	ttinfo_t *info = (void *)(type + tzh_timecnt);
 
-	if ((void *)p + len < (void *)(info + tzh_typecnt)) {
+	if ((void *)p + len < (void *)(info + tzh_typecnt) || tzh_typecnt == 0) {
 		// EOF reached
 		return false;
 	}
 
-	// Binary search
+	// The footer is after the version 2 data. It contains a
+	// POSIX TZ string between newlines.
+	int const footer = header_len +
+		8 * tzh_timecnt +
+		1 * tzh_timecnt +
+		6 * tzh_typecnt +
+		tzh_charcnt +
+		12 * tzh_leapcnt +
+		1 * tzh_ttisstdcnt +
+		1 * tzh_ttisgmtcnt;
+	posix_tz_t rule;
+	bool have_rule = false;
+	if (footer + 1 < len && p[footer] == '\n') {
+		char const *start = p + footer + 1;
+		char const *end = memchr(start, '\n', len - footer - 1);
+		have_rule = end != NULL && parse_posix_tz(start, end, &rule);
+	}
+
+	// Binary search for the first transition after now
 	uint32_t low = 0, high = tzh_timecnt;
-	while (low+1 < high) {
+	while (low < high) {
 		uint32_t mid = (high+low)/2;
-		int64_t ts_mid = be64toh(transition[mid]);
-		if (now < ts_mid) {
+		if (now < (int64_t)be64toh(transition[mid])) {
 			high = mid;
 		} else {
-			low = mid;
+			low = mid+1;
 		}
 	}
+	uint32_t const next = low;
+
+	// Current UTC offset. After the last transition the rule tells
+	// it, before the first the first type is used.
+	if (next == tzh_timecnt && have_rule) {
+		dest->gmtoff_now = posix_gmtoff_at(&rule, now);
+	} else {
+		ttinfo_t *cur = &info[next == 0 ? 0 : type[next-1]];
+		dest->gmtoff_now = be32toh(cur->tt_gmtoff);
+	}
+
+	// Collect the transitions from the file. Some zones have
+	// transitions to the same UTC offset such as
+	// America/Montevideo in 2038. They are skipped.
+	dest->table_len = 0;
+	int32_t prev = dest->gmtoff_now;
+	for (uint32_t i = next; i < tzh_timecnt && dest->table_len < TZ_TABLE_LEN; i++) {
+		int32_t const gmtoff = be32toh(info[type[i]].tt_gmtoff);
+		if (gmtoff == prev) continue;
+		table_add(dest, be64toh(transition[i]), gmtoff);
+		prev = gmtoff;
+	}
 
-	// Find gmtoff
-	ttinfo_t *ttinfo_low = &info[type[low]];
-	ttinfo_t *ttinfo_high = (high == tzh_timecnt) ? NULL : &info[type[high]];
+	// Continue with the rule after the last transition in the
+	// file. Give up if the rule produces nothing in a decade.
+	if (have_rule && rule.has_dst) {
+		int64_t after = tzh_timecnt ? be64toh(transition[tzh_timecnt-1]) : now;
+		if (after < now) after = now;
+		int const first = year_of(after);
+		for (int year = first; year < first + 10 && dest->table_len < TZ_TABLE_LEN; year++) {
+			tz_transition_t t[2];
+			int const n = rule_transitions(&rule, year, t);
+			for (int i = 0; i < n && dest->table_len < TZ_TABLE_LEN; i++) {
+				if (t[i].ts <= after || t[i].gmtoff == prev) continue;
+				table_add(dest, t[i].ts, t[i].gmtoff);
+				prev = t[i].gmtoff;
+			}
+		}
+	}
 
-	// Populate answer
-	dest->gmtoff_now = be32toh(ttinfo_low->tt_gmtoff);
-	if (ttinfo_high == NULL || ttinfo_low->tt_gmtoff == ttinfo_high->tt_gmtoff) {
-		// Some zones have no future transitions or they have
-		// weird have a transition to the same UTC offset such
-		// as America/Montevideo in 2038.
+	// Populate the next transition
+	if (dest->table_len == 0) {
 		dest->transition = 0;
 		dest->gmtoff_after = 0;
 	} else {
-		dest->transition = be64toh(transition[high]);
-		dest->gmtoff_after = be32toh(ttinfo_high->tt_gmtoff);
+		dest->transition = dest->table[0].ts;
+		dest->gmtoff_after = dest->table[0].gmtoff;
 	}
 
 	dest->ref_time = now;
 	return true;
 }
+
+static void table_add(tzinfo_t *dest, int64_t ts, int32_t gmtoff)
+{
+	tz_transition_t *t = dest->table + dest->table_len++;
+	t->ts = ts;
+	t->gmtoff = gmtoff;
+}
+
+// Parse POSIX TZ string such as "EET-2EEST,M3.5.0/3,M10.5.0/4". See
+// tzset(3). Returns false if the format is not understood.
+static bool parse_posix_tz(char const *p, char const *end, posix_tz_t *tz)
+{
+	int32_t offset;
+	p = parse_name(p, end);
+	if (p == NULL) return false;
+	p = parse_offset(p, end, &offset);
+	if (p == NULL) return false;
+
+	// POSIX offsets are positive west of Greenwich
+	tz->std_gmtoff = -offset;
+	tz->has_dst = p != end;
+	if (!tz->has_dst) return true;
+
+	p = parse_name(p, end);
+	if (p == NULL) return false;
+	if (p != end && *p != ',') {
+		p = parse_offset(p, end, &offset);
+		if (p == NULL) return false;
+		tz->dst_gmtoff = -offset;
+	} else {
+		// Summer time is one hour ahead by default
+		tz->dst_gmtoff = tz->std_gmtoff + 3600;
+	}
+
+	// Rules are mandatory in TZif footers
+	if (p == end || *p++ != ',') return false;
+	p = parse_rule(p, end, &tz->start);
+	if (p == NULL || p == end || *p++ != ',') return false;
+	p = parse_rule(p, end, &tz->end);
+	return p == end;
+}
+
+// Skip zone abbreviation, either alphabetic or quoted in <>.
+static char const *parse_name(char const *p, char const *end)
+{
+	char const *start = p;
+	if (p != end && *p == '<') {
+		while (p != end && *p != '>') p++;
+		return p == end ? NULL : p+1;
+	}
+	while (p != end && isalpha(*p)) p++;
+	return p - start < 3 ? NULL : p;
+}
+
+// Parse [+-]hh[:mm[:ss]] to seconds. Hours may be up to 167 as
+// allowed in rule times by TZif version 3.
+static char const *parse_offset(char const *p, char const *end, int32_t *out)
+{
+	int sign = 1;
+	if (p != end && (*p == '+' || *p == '-')) {
+		if (*p == '-') sign = -1;
+		p++;
+	}
+
+	int32_t value = 0;
+	for (int part = 0; part < 3; part++) {
+		if (part > 0) {
+			if (p == end || *p != ':') break;
+			p++;
+		}
+		if (p == end || !isdigit(*p)) return NULL;
+		int n = 0;
+		while (p != end && isdigit(*p)) n = n * 10 + *p++ - '0';
+		value += n * (part == 0 ? 3600 : part == 1 ? 60 : 1);
+	}
+	*out = sign * value;
+	return p;
+}
+
+// Parse date rule with optional /time.
+static char const *parse_rule(char const *p, char const *end, tz_rule_t *rule)
+{
+	int *fields[3] = { &rule->month, &rule->week, &rule->day };
+	int nfields;
+	if (p != end && *p == 'M') {
+		rule->type = 'M';
+		nfields = 3;
+		p++;
+	} else if (p != end && *p == 'J') {
+		rule->type = 'J';
+		fields[0] = &rule->day;
+		nfields = 1;
+		p++;
+	} else {
+		rule->type = 'n';
+		fields[0] = &rule->day;
+		nfields = 1;
+	}
+
+	for (int i = 0; i < nfields; i++) {
+		if (i > 0) {
+			if (p == end || *p != '.') return NULL;
+			p++;
+		}
+		if (p == end || !isdigit(*p)) return NULL;
+		int n = 0;
+		while (p != end && isdigit(*p)) n = n * 10 + *p++ - '0';
+		*fields[i] = n;
+	}
+
+	if (rule->type == 'M' && (rule->month < 1 || rule->month > 12 ||
+				  rule->week < 1 || rule->week > 5 || rule->day > 6)) {
+		return NULL;
+	}
+
+	// Default time of change is 02:00:00 local time
+	rule->time = 7200;
+	if (p != end && *p == '/') {
+		p = parse_offset(p+1, end, &rule->time);
+	}
+	return p;
+}
+
+// Calculate transitions of the given year, sorted. Returns the number
+// of transitions stored to out.
+static int rule_transitions(posix_tz_t const *tz, int year, tz_transition_t *out)
+{
+	// Change to summer time happens in standard time and vice
+	// versa.
+	tz_transition_t const start = { rule_to_utc(&tz->start, year, tz->std_gmtoff), tz->dst_gmtoff };
+	tz_transition_t const end = { rule_to_utc(&tz->end, year, tz->dst_gmtoff), tz->std_gmtoff };
+
+	// Southern hemisphere has summer time at the turn of the year
+	bool const southern = end.ts < start.ts;
+	out[0] = southern ? end : start;
+	out[1] = southern ? start : end;
+	return 2;
+}
+
+// Get the UTC time of the rule in the given year when the local time
+// has the given UTC offset.
+static int64_t rule_to_utc(tz_rule_t const *rule, int year, int32_t gmtoff)
+{
+	int64_t days;
+	switch (rule->type) {
+	case 'J':
+		// Leap day is never counted
+		days = days_from_civil(year, 1, 1) + rule->day - 1;
+		if (is_leap(year) && rule->day >= 60) days++;
+		break;
+	case 'n':
+		days = days_from_civil(year, 1, 1) + rule->day;
+		break;
+	default: {
+		// Day of the week of the first day of the month. 1970-01-01
+		// was Thursday.
+		int64_t const first = days_from_civil(year, rule->month, 1);
+		int const wday = (first % 7 + 11) % 7;
+		days = first + (rule->day - wday + 7) % 7 + (rule->week - 1) * 7;
+
+		// Week 5 means the last one of the month
+		int const next_month = rule->month == 12 ? 13 : rule->month + 1;
+		int64_t const month_end = next_month == 13 ?
+			days_from_civil(year + 1, 1, 1) :
+			days_from_civil(year, next_month, 1);
+		while (days >= month_end) days -= 7;
+		break;
+	}
+	}
+	return days * 86400 + rule->time - gmtoff;
+}
+
+// Get UTC offset of the POSIX rule at the given time.
+static int32_t posix_gmtoff_at(posix_tz_t const *tz, int64_t ts)
+{
+	if (!tz->has_dst) return tz->std_gmtoff;
+
+	// The latest transition of this or the previous year
+	int const year = year_of(ts);
+	int32_t gmtoff = tz->std_gmtoff;
+	for (int y = year - 1; y <= year; y++) {
+		tz_transition_t t[2];
+		int const n = rule_transitions(tz, y, t);
+		for (int i = 0; i < n; i++) {
+			if (t[i].ts <= ts) gmtoff = t[i].gmtoff;
+		}
+	}
+	return gmtoff;
+}
+
+// Days since UNIX epoch of the given date. Algorithm from
+// http://howardhinnant.github.io/date_algorithms.html
+static int64_t days_from_civil(int year, int month, int day)
+{
+	year -= month <= 2;
+	int64_t const era = (year >= 0 ? year : year - 399) / 400;
+	int const yoe = year - era * 400;
+	int const doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	int const doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+static bool is_leap(int year)
+{
+	return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+// Get UTC year of the given timestamp.
+static int year_of(int64_t ts)
+{
+	time_t const t = ts;
+	struct tm tm;
+	gmtime_r(&t, &tm);
+	return tm.tm_year + 1900;
+}
@@ -3,14 +3,27 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+// Maximum number of future transitions collected to the table. Keep
+// in sync with CLOCK_DST_LEN in the firmware.
+#define TZ_TABLE_LEN 10
+
+typedef struct {
+	int64_t ts;     // UNIX timestamp of the transition
+	int32_t gmtoff; // UTC offset after the transition
+} tz_transition_t;
+
 typedef struct {
 	time_t ref_time;
 	int32_t gmtoff_now;
 	uint64_t transition;
 	int32_t gmtoff_after;
+	int table_len;
+	tz_transition_t table[TZ_TABLE_LEN]; // Next transitions
 } tzinfo_t;
 
-// Populate given tzinfo with the next gmtoff change
+// Populate given tzinfo with the next gmtoff changes. The changes
+// after the transitions listed in the zone file are calculated from
+// the POSIX TZ rule at the end of the file.
 bool tz_populate_tzinfo(tzinfo_t *dest, char const *zone, int64_t now);
 
 // Resolve time zone name. Results are indicative; with some